@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+/* Shared by the benchmarks: times a function and counts the heap allocations it makes.
+ * malloc, calloc and realloc are replaced by counting wrappers around the glibc allocator,
+ * so allocs/op covers sd-bus as well as operator new, which allocates through malloc.
+ * Include it from exactly one translation unit per executable.
+ */
+
+extern "C" {
+void *__libc_malloc( std::size_t size );
+void *__libc_calloc( std::size_t count, std::size_t size );
+void *__libc_realloc( void *p, std::size_t size );
+}
+
+inline std::atomic<std::size_t> allocations { 0 };
+
+extern "C" void *malloc( std::size_t size ) {
+  allocations.fetch_add( 1, std::memory_order_relaxed );
+  return __libc_malloc( size );
+}
+
+extern "C" void *calloc( std::size_t count, std::size_t size ) {
+  allocations.fetch_add( 1, std::memory_order_relaxed );
+  return __libc_calloc( count, size );
+}
+
+extern "C" void *realloc( void *p, std::size_t size ) {
+  allocations.fetch_add( 1, std::memory_order_relaxed );
+  return __libc_realloc( p, size );
+}
+
+// values > 1 reports the cost per value of a batch instead of per call
+template <typename F>
+void run( const char *name, std::size_t iterations, std::size_t values, F f ) {
+  f();  // warm up
+
+  std::size_t before = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for ( std::size_t i = 0; i < iterations; ++i )
+    f();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  std::size_t allocs = allocations.load() - before;
+
+  double ops = static_cast<double>( iterations ) * values;
+  const char *unit = values > 1 ? "/value" : "/op";
+  std::cout << name << ": "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count() / ops
+            << " ns" << unit << ", " << allocs / ops << " allocs" << unit << "\n";
+}
+
+template <typename F>
+void run( const char *name, std::size_t iterations, F f ) {
+  run( name, iterations, 1, f );
+}
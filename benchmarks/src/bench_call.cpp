@@ -0,0 +1,61 @@
+#include "bench.h"
+#include <dbuscpp/dbuscpp.h>
+#include <string>
+#include <string_view>
+
+using namespace dbus;
+
+/* methodCall -> call -> read round-trip, against an in-process LoopbackService that
+ * answers NameHasOwner and GetId like the broker does, or against the bus daemon itself
+ * with --system.
+ * allocs/op counts every malloc of the process, sd-bus and the loopback service included.
+ */
+
+int main( int argc, char **argv ) {
+  std::size_t iterations = 10000;
+  bool system = false;
+  for ( int i = 1; i < argc; ++i ) {
+    if ( std::string_view { argv[i] } == "--system" )
+      system = true;
+    else
+      iterations = std::stoul( argv[i] );
+  }
+
+  LoopbackService service;
+  service.method( "org.freedesktop.DBus", "NameHasOwner", []( Reply &call, Message &reply ) {
+    std::string_view name;
+    call.read( name );
+    reply.write( name == "org.freedesktop.DBus" );
+  } );
+  service.method( "org.freedesktop.DBus", "GetId", []( Reply &, Message &reply ) {
+    reply.write( "0123456789abcdef0123456789abcdef" );
+  } );
+  Manager manager = system ? Manager {} : Manager { service.connection() };
+
+  run( "NameHasOwner (bool)", iterations, [&]() {
+    Message m = manager.methodCall(
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameHasOwner" );
+    m.write( "org.freedesktop.DBus" );
+    Reply r = manager.call( m );
+    bool value = false;
+    r.read( value );
+  } );
+
+  run( "GetId (string_view)", iterations, [&]() {
+    Message m = manager.methodCall(
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetId" );
+    Reply r = manager.call( m );
+    std::string_view value;
+    r.read( value );
+  } );
+
+  std::string id;
+  run( "GetId (reused string)", iterations, [&]() {
+    Message m = manager.methodCall(
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetId" );
+    Reply r = manager.call( m );
+    r.read( id );
+  } );
+
+  return 0;
+}
@@ -0,0 +1,298 @@
+#include "bench.h"
+#include <cstddef>
+#include <cstdint>
+#include <dbuscpp/dbuscpp.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dbus;
+
+/* Per-API cost of encoding into a Message and decoding from a Reply, no bus daemon needed.
+ * Encoding runs on a fresh method call each iteration, "empty methodCall" is that baseline.
+ * Decoding reads the same reply over and over, rewinding it first; the reply comes from
+ * the Echo method of a LoopbackService, so it is a real, sealed message off the socket.
+ * Batches of 16 or 256 values report the cost per value, the message creation included.
+ */
+
+struct Sample {
+  std::string name;
+  uint32_t id;
+  double value;
+};
+
+struct Node {
+  ObjectPath path;
+  Sample sample;
+  std::vector<Sample> children;
+};
+
+DBUSCPP_STRUCT( Sample, name, id, value )
+DBUSCPP_STRUCT( Node, path, sample, children )
+
+namespace {
+const std::size_t PROPERTIES = 16;
+const std::size_t OBJECTS = 32;
+const std::size_t VALUES = 256;
+
+Manager *manager = nullptr;
+
+Message echo() {
+  return manager->methodCall( "org.dbuscpp.Bench", "/bench", LoopbackService::INTERFACE, "Echo" );
+}
+
+// the values a typical properties reply carries
+PropertyValue property( std::size_t i ) {
+  switch ( i % 4 ) {
+  case 0:
+    return std::string( "value" );
+  case 1:
+    return uint32_t( i );
+  case 2:
+    return double( i ) / 3;
+  default:
+    return bool( i & 1 );
+  }
+}
+
+void writeProperties( Message &m ) {
+  static const std::vector<std::string> names = []() {
+    std::vector<std::string> v;
+    for ( std::size_t i = 0; i < PROPERTIES; ++i )
+      v.push_back( "Property" + std::to_string( i ) );
+    return v;
+  }();
+
+  m.openContainer( DATA_TYPE::ARRAY, "{sv}" );
+  for ( std::size_t i = 0; i < PROPERTIES; ++i ) {
+    m.openContainer( DATA_TYPE::DICT_ENTRY, "sv" );
+    m.write( names[i] );
+    writeVariant( m, property( i ) );
+    m.closeContainer();
+  }
+  m.closeContainer();
+}
+
+std::size_t readProperties( Reply &r ) {
+  std::size_t n = 0;
+  std::string_view name;
+  PropertyValue value;
+  r.enterContainer( DATA_TYPE::ARRAY, "{sv}" );
+  while ( !r.atEnd() ) {
+    r.enterContainer( DATA_TYPE::DICT_ENTRY, "sv" );
+    r.read( name );
+    readVariant( r, value );
+    r.exitContainer();
+    ++n;
+  }
+  r.exitContainer();
+  return n;
+}
+
+// GetManagedObjects: a{oa{sa{sv}}}
+void writeObjects( Message &m ) {
+  static const std::vector<ObjectPath> paths = []() {
+    std::vector<ObjectPath> v;
+    for ( std::size_t i = 0; i < OBJECTS; ++i )
+      v.push_back( ObjectPath { "/org/dbuscpp/bench/object" + std::to_string( i ) } );
+    return v;
+  }();
+
+  m.openContainer( DATA_TYPE::ARRAY, "{oa{sa{sv}}}" );
+  for ( auto &path : paths ) {
+    m.openContainer( DATA_TYPE::DICT_ENTRY, "oa{sa{sv}}" );
+    m.write( path );
+    m.openContainer( DATA_TYPE::ARRAY, "{sa{sv}}" );
+    for ( const char *interface : { "org.dbuscpp.Bench.Device", "org.dbuscpp.Bench.Sensor" } ) {
+      m.openContainer( DATA_TYPE::DICT_ENTRY, "sa{sv}" );
+      m.write( interface );
+      writeProperties( m );
+      m.closeContainer();
+    }
+    m.closeContainer();
+    m.closeContainer();
+  }
+  m.closeContainer();
+}
+
+std::size_t readObjects( Reply &r ) {
+  std::size_t n = 0;
+  ObjectPath path;
+  std::string interface;
+  r.enterContainer( DATA_TYPE::ARRAY, "{oa{sa{sv}}}" );
+  while ( !r.atEnd() ) {
+    r.enterContainer( DATA_TYPE::DICT_ENTRY, "oa{sa{sv}}" );
+    r.read( path );
+    r.enterContainer( DATA_TYPE::ARRAY, "{sa{sv}}" );
+    while ( !r.atEnd() ) {
+      r.enterContainer( DATA_TYPE::DICT_ENTRY, "sa{sv}" );
+      r.read( interface );
+      n += readProperties( r );
+      r.exitContainer();
+    }
+    r.exitContainer();
+    r.exitContainer();
+  }
+  r.exitContainer();
+  return n;
+}
+
+std::vector<Node> nodes() {
+  std::vector<Node> v;
+  for ( std::size_t i = 0; i < OBJECTS; ++i ) {
+    Node node { ObjectPath { "/org/dbuscpp/bench/node" + std::to_string( i ) },
+      { "sample", uint32_t( i ), 0.5 },
+      {} };
+    for ( uint32_t j = 0; j < 4; ++j )
+      node.children.push_back( { "child" + std::to_string( j ), j, double( j ) } );
+    v.push_back( std::move( node ) );
+  }
+  return v;
+}
+}  // namespace
+
+int main( int argc, char **argv ) {
+  std::size_t iterations = argc > 1 ? std::stoul( argv[1] ) : 10000;
+  std::size_t large = iterations / 100 ? iterations / 100 : 1;
+
+  LoopbackService service;
+  Manager loopback { service.connection() };
+  manager = &loopback;
+
+  // encode
+  run( "empty methodCall", iterations, []() { Message m = echo(); } );
+
+  run( "write uint32 x256", iterations, VALUES, []() {
+    Message m = echo();
+    for ( uint32_t i = 0; i < VALUES; ++i )
+      m.write( i );
+  } );
+
+  run( "write string x256", iterations, VALUES, []() {
+    static const std::string value( "org.dbuscpp.Bench.Value" );
+    Message m = echo();
+    for ( std::size_t i = 0; i < VALUES; ++i )
+      m.write( value );
+  } );
+
+  run( "open/close struct x256", iterations, VALUES, []() {
+    Message m = echo();
+    m.openContainer( DATA_TYPE::ARRAY, "(u)" );
+    for ( uint32_t i = 0; i < VALUES; ++i ) {
+      m.openContainer( DATA_TYPE::STRUCT, "u" );
+      m.write( i );
+      m.closeContainer();
+    }
+    m.closeContainer();
+  } );
+
+  run( "write a{sv} x16", iterations, PROPERTIES, []() {
+    Message m = echo();
+    writeProperties( m );
+  } );
+
+  run( "write a{oa{sa{sv}}} 32x2x16", large, []() {
+    Message m = echo();
+    writeObjects( m );
+  } );
+
+  const std::vector<std::byte> bytes( 1 << 20, std::byte { 0x5a } );
+  run( "write ay 1MiB", large, [&]() {
+    Message m = echo();
+    m.write( bytes );
+  } );
+
+  const std::vector<Node> tree = nodes();
+  run( "write a(o(sud)a(sud)) 32x4", iterations, [&]() {
+    Message m = echo();
+    m.write( tree );
+  } );
+
+  // decode, one sealed reply per payload
+  Message m = echo();
+  for ( uint32_t i = 0; i < VALUES; ++i )
+    m.write( i );
+  Reply values = loopback.call( m );
+  run( "read uint32 x256", iterations, VALUES, [&]() {
+    values.rewind();
+    uint32_t value;
+    for ( std::size_t i = 0; i < VALUES; ++i )
+      values.read( value );
+  } );
+
+  m = echo();
+  m.openContainer( DATA_TYPE::ARRAY, DATA_TYPE::STRING );
+  for ( std::size_t i = 0; i < VALUES; ++i )
+    m.write( "org.dbuscpp.Bench.Value" );
+  m.closeContainer();
+  Reply strings = loopback.call( m );
+  run( "read string_view x256", iterations, VALUES, [&]() {
+    strings.rewind();
+    std::string_view value;
+    strings.enterContainer( DATA_TYPE::ARRAY, DATA_TYPE::STRING );
+    while ( !strings.atEnd() )
+      strings.read( value );
+    strings.exitContainer();
+  } );
+  run( "read string x256", iterations, VALUES, [&]() {
+    strings.rewind();
+    std::string value;
+    strings.enterContainer( DATA_TYPE::ARRAY, DATA_TYPE::STRING );
+    while ( !strings.atEnd() )
+      strings.read( value );
+    strings.exitContainer();
+  } );
+  run( "read vector<string> x256", iterations, VALUES, [&]() {
+    strings.rewind();
+    std::vector<std::string> value;
+    strings.read( value );
+  } );
+
+  m = echo();
+  m.openContainer( DATA_TYPE::ARRAY, DATA_TYPE::OBJECT_PATH );
+  for ( std::size_t i = 0; i < VALUES; ++i )
+    m.write( ObjectPath { "/org/dbuscpp/bench/object" + std::to_string( i ) } );
+  m.closeContainer();
+  Reply paths = loopback.call( m );
+  run( "read vector<ObjectPath> x256", iterations, VALUES, [&]() {
+    paths.rewind();
+    std::vector<ObjectPath> value;
+    paths.read( value );
+  } );
+
+  m = echo();
+  writeProperties( m );
+  Reply properties = loopback.call( m );
+  run( "read a{sv} x16", iterations, PROPERTIES, [&]() {
+    properties.rewind();
+    readProperties( properties );
+  } );
+
+  m = echo();
+  writeObjects( m );
+  Reply objects = loopback.call( m );
+  run( "read a{oa{sa{sv}}} 32x2x16", large, [&]() {
+    objects.rewind();
+    readObjects( objects );
+  } );
+
+  m = echo();
+  m.write( bytes );
+  Reply blob = loopback.call( m );
+  run( "read ay 1MiB", large, [&]() {
+    blob.rewind();
+    std::vector<std::byte> value;
+    blob.read( value );
+  } );
+
+  m = echo();
+  m.write( tree );
+  Reply structs = loopback.call( m );
+  run( "read a(o(sud)a(sud)) 32x4", iterations, [&]() {
+    structs.rewind();
+    std::vector<Node> value;
+    structs.read( value );
+  } );
+
+  return 0;
+}
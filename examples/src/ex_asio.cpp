@@ -0,0 +1,59 @@
+#include <boost/asio.hpp>
+#include <dbuscpp/asio_manager.h>
+#include <dbuscpp/dbuscpp.h>
+#include <iostream>
+#include <string>
+
+using namespace dbus;
+
+int main() {
+  boost::asio::io_context io;
+  AsioManager manager( io );
+
+  manager.async_property_get( "org.bluez",
+    "/org/bluez/hci0",
+    "org.bluez.Adapter1",
+    "Name",
+    []( boost::system::error_code ec, Reply reply ) {
+      if ( ec ) {
+        std::cout << "property get failed: " << ec.message() << "\n";
+        return;
+      }
+      std::string name;
+      reply.enterContainer();
+      reply.read( name );
+      std::cout << "adapter name: " << name << "\n";
+    } );
+
+  Message m = manager.methodCall( "org.freedesktop.UPower",
+    "/org/freedesktop/UPower",
+    "org.freedesktop.UPower",
+    "GetCriticalAction" );
+  manager.async_call( m, []( boost::system::error_code ec, Reply reply ) {
+    if ( ec ) {
+      std::cout << "call failed: " << ec.message() << "\n";
+      return;
+    }
+    std::string action;
+    reply.read( action );
+    std::cout << "critical action: " << action << "\n";
+  } );
+
+  SignalID id = manager.subscribe(
+    "type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged'" );
+  std::function<void( boost::system::error_code, Reply )> onSignal;
+  onSignal = [&]( boost::system::error_code ec, Reply reply ) {
+    if ( ec )
+      return;
+    std::cout << "signal from " << reply.sender() << " on " << reply.path() << "\n";
+    manager.async_signal( id, onSignal );
+  };
+  manager.async_signal( id, onSignal );
+
+  // stop after 10 seconds, the bus descriptor keeps the io_context busy otherwise
+  boost::asio::steady_timer timer( io, std::chrono::seconds( 10 ) );
+  timer.async_wait( [&]( boost::system::error_code ) { io.stop(); } );
+
+  io.run();
+  return 0;
+}
@@ -0,0 +1,45 @@
+#include <dbuscpp/dbuscpp.h>
+#include <iostream>
+#include <string>
+
+using namespace dbus;
+
+int main() {
+  Manager manager;
+
+  // objects implementing org.bluez.Device1, decoded while walking the reply
+  std::vector<PropertyRequest> requests;
+  manager.objects( "org.bluez", [&]( const ObjectPath &object, auto &interfaces ) {
+    for ( auto &interface : interfaces )
+      if ( interface.key() == "org.bluez.Device1" )
+        requests.push_back( { "org.bluez", object, "org.bluez.Device1", "RSSI", {} } );
+    return true;
+  } );
+
+  // one round-trip for all devices
+  auto results = manager.propertyGetBatch( requests );
+  for ( std::size_t i = 0; i < results.size(); ++i ) {
+    std::cout << requests[i].object << ": ";
+    if ( !results[i].ok() )
+      std::cout << results[i].errorMessage << "\n";
+    else if ( auto rssi = std::get_if<int16_t>( &results[i].value ) )
+      std::cout << *rssi << " dBm\n";
+  }
+
+  for ( auto &req : requests ) {
+    req.member = "Trusted";
+    req.value = true;
+  }
+  for ( auto &result : manager.propertySetBatch( requests ) )
+    if ( !result.ok() )
+      std::cout << "set failed: " << result.errorMessage << "\n";
+
+  // same again without waiting for any reply, flushed once at the end of the scope
+  {
+    SendBatch batch { manager };
+    for ( auto &req : requests )
+      batch.propertySet( req.service, req.object, req.interface, "Trusted", false );
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <utility>
+#include <boost/asio.hpp>
+#include <dbuscpp/coroutine.h>
+#include <dbuscpp/dbuscpp.h>
+#include <iostream>
+#include <string>
+
+using namespace dbus;
+using boost::asio::awaitable;
+
+// enumerate the devices, read their alias, then make the adapter discoverable
+awaitable<void> workflow( AsioManager &manager ) {
+  Message m =
+    manager.methodCall( "org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects" );
+  Reply objects = co_await call( manager, m );
+
+  std::vector<ObjectPath> devices;
+  ObjectPath object;
+  objects.enterContainer( DATA_TYPE::ARRAY, "{oa{sa{sv}}}" );
+  while ( objects.enterContainerIf( DATA_TYPE::DICT_ENTRY, "oa{sa{sv}}" ) ) {
+    objects.read( object );
+    if ( object.find( "/dev_" ) != std::string::npos )
+      devices.push_back( object );
+    objects.skip( "a{sa{sv}}" );
+    objects.exitContainer();
+  }
+  objects.exitContainer();
+
+  for ( auto &device : devices ) {
+    try {
+      std::string alias = co_await propertyGetDirect<std::string>(
+        manager, "org.bluez", device, "org.bluez.Device1", "Alias" );
+      std::cout << device << ": " << alias << "\n";
+    } catch ( boost::system::system_error &e ) {
+      std::cout << device << ": " << e.what() << "\n";
+    }
+  }
+
+  co_await propertySetDirect(
+    manager, "org.bluez", "/org/bluez/hci0", "org.bluez.Adapter1", "Discoverable", true );
+}
+
+awaitable<void> watch( AsioManager &manager ) {
+  SignalStream stream( manager,
+    "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties'" );
+  for ( ;; ) {
+    Reply signal = co_await stream.next();
+    std::cout << "properties changed on " << signal.path() << "\n";
+  }
+}
+
+int main() {
+  boost::asio::io_context io;
+  AsioManager manager( io );
+
+  auto report = []( std::exception_ptr e ) {
+    try {
+      if ( e )
+        std::rethrow_exception( e );
+    } catch ( std::exception &ex ) {
+      std::cout << ex.what() << "\n";
+    }
+  };
+  boost::asio::co_spawn( io, workflow( manager ), report );
+  boost::asio::co_spawn( io, watch( manager ), report );
+
+  boost::asio::steady_timer timer( io, std::chrono::seconds( 10 ) );
+  timer.async_wait( [&]( boost::system::error_code ) { io.stop(); } );
+
+  io.run();
+  return 0;
+}
@@ -0,0 +1,34 @@
+#include <dbuscpp/dbuscpp.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace dbus;
+
+int main() {
+  SignalEmitter emitter;
+  emitter.history( 1 );  // last value per sensor for late joiners
+
+  std::vector<PreparedSignal> sensors;
+  for ( int i = 0; i < 16; ++i )
+    sensors.emplace_back(
+      "/com/example/sensor" + std::to_string( i ), "com.example.Sensor", "Level" );
+
+  auto start = std::chrono::steady_clock::now();
+  for ( int round = 0; round < 1000; ++round ) {
+    std::vector<Message> batch;
+    for ( auto &sensor : sensors ) {
+      Message m = emitter.signal( sensor );
+      m.write( static_cast<double>( round ) );
+      batch.push_back( m );
+    }
+    emitter.emit( batch );  // one flush per round
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start );
+
+  std::cout << 1000 * sensors.size() << " signals in " << elapsed.count() << " ms\n";
+  std::cout << emitter.last( "/com/example/sensor0" ).size() << " kept for sensor0\n";
+  return 0;
+}
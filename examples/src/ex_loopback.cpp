@@ -0,0 +1,55 @@
+#include <dbuscpp/dbuscpp.h>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace dbus;
+
+// talks to an in-process service, runs anywhere without a bus
+int main() {
+  LoopbackService service;
+  service.property( "com.example.Sensor", "Level", 42.0 );
+  service.method( "com.example.Sensor", "Scale", []( Reply &call, Message &reply ) {
+    int32_t factor = 0;
+    call.read( factor );
+    reply.write( 42.0 * factor );
+  } );
+  service.delay( std::chrono::microseconds( 200 ) );
+
+  PropertyWatcher watcher { "", "/com/example", "com.example.Sensor" };
+  watcher.on<double>( "Level", []( const ObjectPath &object, const double &level ) {
+    std::cout << object << " Level changed to " << level << "\n";
+  } );
+  SignalGroup::useConnection( service.connection() );
+  watcher.start();
+
+  Manager manager { service.connection() };
+  double level = 0;
+  manager.propertyGetDirect(
+    "com.example", "/com/example/sensor0", "com.example.Sensor", "Level", level );
+  std::cout << "Level " << level << "\n";
+
+  Message scale =
+    manager.methodCall( "com.example", "/com/example/sensor0", "com.example.Sensor", "Scale" );
+  scale.write( int32_t( 3 ) );
+  Reply scaled = manager.call( scale );
+  scaled.read( level );
+  std::cout << "Scale(3) " << level << "\n";
+
+  Message echo =
+    manager.methodCall( "com.example", "/com/example/sensor0", LoopbackService::INTERFACE, "Echo" );
+  echo.write( std::string( "ping" ) );
+  Reply echoed = manager.call( echo );
+  std::string text;
+  echoed.read( text );
+  std::cout << "Echo " << text << "\n";
+
+  manager.propertySetDirect(
+    "com.example", "/com/example/sensor0", "com.example.Sensor", "Level", 7.5 );
+  std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+
+  std::cout << service.calls() << " calls served\n";
+  return 0;
+}
@@ -0,0 +1,25 @@
+#include <dbuscpp/dbuscpp.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace dbus;
+
+// run as root: keeps the last 1024 messages to or from systemd, prints them every 5 s
+int main() {
+  Monitor monitor { 1024 };
+  monitor.start(
+    { "sender='org.freedesktop.systemd1'", "destination='org.freedesktop.systemd1'" } );
+
+  for ( int round = 0; round < 6; ++round ) {
+    std::this_thread::sleep_for( std::chrono::seconds( 5 ) );
+    monitor.drain( []( Reply &m ) {
+      std::cout << m.sender() << " " << m.path() << " " << m.interface() << "." << m.member()
+                << " (" << m.signature() << ")\n";
+    } );
+    std::cout << monitor.captured() << " captured, " << monitor.overwritten()
+              << " overwritten\n";
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <dbuscpp/dbuscpp.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace dbus;
+
+// ex_record                      records ten seconds of calls and signals to /tmp/dbus.rec
+// ex_record <address> [speed]    replays them against another bus, e.g. a private daemon:
+//   dbus-daemon --session --address=unix:path=/tmp/test-bus &
+//   ex_record unix:path=/tmp/test-bus 10
+int main( int argc, char *argv[] ) {
+  const char *file = "/tmp/dbus.rec";
+
+  if ( argc < 2 ) {
+    Manager manager;
+    auto recorder = std::make_shared<Recorder>( file );
+    manager.connection().record( recorder );
+
+    auto id = SignalGroup::createSignal();
+    SignalGroup::matchRule( id, "type='signal',sender='org.freedesktop.systemd1'" );
+    SignalGroup::add( id );
+    SignalGroup::start();
+
+    for ( int i = 0; i < 10; ++i ) {
+      manager.propertyGet( "org.freedesktop.systemd1",
+        "/org/freedesktop/systemd1",
+        "org.freedesktop.systemd1.Manager",
+        "NNames" );
+      std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+    }
+    recorder->flush();
+    std::cout << recorder->records() << " messages, " << recorder->bytes() << " bytes, "
+              << recorder->dropped() << " dropped\n";
+    return 0;
+  }
+
+  Recording recording { file };
+  Connection target { argv[1] };
+  Replayer replayer { recording, target };
+  ReplayStats stats = replayer.run( argc > 2 ? std::stod( argv[2] ) : 1.0 );
+
+  std::cout << recording.size() << " recorded, " << stats.calls << " calls and " << stats.signals
+            << " signals replayed in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>( stats.elapsed ).count()
+            << " ms, " << stats.errors << " errors\n";
+  std::cout << "call p50 " << replayer.latency().percentile( 0.5 ) << " us, p99 "
+            << replayer.latency().percentile( 0.99 ) << " us\n";
+  return 0;
+}
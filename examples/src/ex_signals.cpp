@@ -35,7 +35,20 @@ int main() {
   std::cout << "Signal1 ID: " << id1 << "\n";
   SignalGroup::add( id1 );
 
+  LoopConfig config;
+  config.busyPoll = std::chrono::microseconds { 200 };
+  config.name = "dbus-signals";
+  config.reconnectMax = std::chrono::seconds { 5 };
+  SignalGroup::configure( config );
+  // try: systemctl restart dbus
+  SignalGroup::registerReconnect( []() { std::cout << "reconnected, matches sent again\n"; } );
+
   SignalGroup::start();
   wait_for( 10 );
+
+  auto latency = SignalGroup::latency( id1 );
+  std::cout << latency->queue.count() << " signals, queue p99 "
+            << latency->queue.percentile( 0.99 ) << " us, callback p99 "
+            << latency->callback.percentile( 0.99 ) << " us\n";
   return 0;
 }
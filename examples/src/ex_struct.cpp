@@ -0,0 +1,52 @@
+#include <dbuscpp/dbuscpp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace dbus;
+
+struct Unit {
+  std::string name;
+  std::string description;
+  std::string loadState;
+  std::string activeState;
+  std::string subState;
+  std::string following;
+  ObjectPath path;
+  uint32_t jobId;
+  std::string jobType;
+  ObjectPath jobPath;
+};
+
+DBUSCPP_STRUCT( Unit,
+  name,
+  description,
+  loadState,
+  activeState,
+  subState,
+  following,
+  path,
+  jobId,
+  jobType,
+  jobPath )
+
+int main() {
+  Manager manager;
+
+  Message m = manager.methodCall( "org.freedesktop.systemd1",
+    "/org/freedesktop/systemd1",
+    "org.freedesktop.systemd1.Manager",
+    "ListUnits" );
+  Reply reply = manager.call( m );
+
+  // a(ssssssouso) in one pass
+  std::vector<Unit> units;
+  reply.read( units );
+
+  std::cout << signatureOf<Unit>() << ": " << units.size() << " units\n";
+  for ( auto &unit : units )
+    if ( unit.activeState == "failed" )
+      std::cout << unit.name << " (" << unit.description << ")\n";
+
+  return 0;
+}
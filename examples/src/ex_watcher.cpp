@@ -0,0 +1,32 @@
+#include <dbuscpp/dbuscpp.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace dbus;
+
+// prints unit state changes, try: systemctl restart <some unit>
+int main() {
+  PropertyWatcher units { "org.freedesktop.systemd1",
+    "/org/freedesktop/systemd1/unit",
+    "org.freedesktop.systemd1.Unit" };
+
+  units.on<std::string_view>(
+    "ActiveState", []( const ObjectPath &unit, const std::string_view &state ) {
+      std::cout << unit << " ActiveState " << state << "\n";
+    } );
+  units.on<std::string_view>(
+    "SubState", []( const ObjectPath &unit, const std::string_view &state ) {
+      std::cout << unit << " SubState " << state << "\n";
+    } );
+  units.on<uint64_t>( "StateChangeTimestamp", []( const ObjectPath &unit, const uint64_t &usec ) {
+    std::cout << unit << " changed at " << usec << " us\n";
+  } );
+
+  std::cout << "match: " << units.rule() << "\n";
+  units.start();
+
+  std::this_thread::sleep_for( std::chrono::seconds( 30 ) );
+  return 0;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/message.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signature.h"
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/* Mapping of C++ aggregates to D-Bus structs:
+ *   struct Unit { std::string name; std::string description; uint32_t jobId; };
+ *   DBUSCPP_STRUCT( Unit, name, description, jobId )
+ * gives Signature<Unit> "(ssu)" at compile time and lets Message::write and
+ * Reply::read take a Unit or a std::vector<Unit> in a single pass, holding the
+ * message lock once instead of once per field. Members may be basic types,
+ * strings, object paths, vectors or other described structs.
+ * The macro must be used at global scope, up to 16 members.
+ */
+
+#define DBUSCPP_STRUCT( Type, ... )                                                 \
+  template <>                                                                       \
+  struct dbus::Describe<Type> {                                                     \
+    static constexpr auto members =                                                 \
+      std::make_tuple( DBUSCPP_MEMBERS( Type, __VA_ARGS__ ) );                       \
+  };
+
+#define DBUSCPP_CAT_( a, b ) a##b
+#define DBUSCPP_CAT( a, b ) DBUSCPP_CAT_( a, b )
+#define DBUSCPP_COUNT_( _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ... ) \
+  N
+#define DBUSCPP_COUNT( ... ) \
+  DBUSCPP_COUNT_( __VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 )
+#define DBUSCPP_MEMBERS( T, ... ) \
+  DBUSCPP_CAT( DBUSCPP_MEMBERS_, DBUSCPP_COUNT( __VA_ARGS__ ) )( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_1( T, m ) &T::m
+#define DBUSCPP_MEMBERS_2( T, m, ... ) &T::m, DBUSCPP_MEMBERS_1( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_3( T, m, ... ) &T::m, DBUSCPP_MEMBERS_2( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_4( T, m, ... ) &T::m, DBUSCPP_MEMBERS_3( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_5( T, m, ... ) &T::m, DBUSCPP_MEMBERS_4( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_6( T, m, ... ) &T::m, DBUSCPP_MEMBERS_5( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_7( T, m, ... ) &T::m, DBUSCPP_MEMBERS_6( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_8( T, m, ... ) &T::m, DBUSCPP_MEMBERS_7( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_9( T, m, ... ) &T::m, DBUSCPP_MEMBERS_8( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_10( T, m, ... ) &T::m, DBUSCPP_MEMBERS_9( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_11( T, m, ... ) &T::m, DBUSCPP_MEMBERS_10( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_12( T, m, ... ) &T::m, DBUSCPP_MEMBERS_11( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_13( T, m, ... ) &T::m, DBUSCPP_MEMBERS_12( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_14( T, m, ... ) &T::m, DBUSCPP_MEMBERS_13( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_15( T, m, ... ) &T::m, DBUSCPP_MEMBERS_14( T, __VA_ARGS__ )
+#define DBUSCPP_MEMBERS_16( T, m, ... ) &T::m, DBUSCPP_MEMBERS_15( T, __VA_ARGS__ )
+
+namespace dbus {
+
+namespace detail {
+template <typename P>
+struct MemberType;
+template <typename C, typename M>
+struct MemberType<M C::*> {
+  using type = M;
+};
+
+// signature of the members, without the parentheses
+template <typename T, typename Members = std::remove_const_t<decltype( Describe<T>::members )>>
+struct StructContents;
+template <typename T, typename... P>
+struct StructContents<T, std::tuple<P...>> {
+  static constexpr auto value =
+    ( SignatureString<0> {} + ... + Signature<typename MemberType<P>::type>::value );
+};
+
+template <typename T>
+struct Marshal {
+  static void write( Message &m, const T &value ) {
+    if constexpr ( std::is_same_v<T, bool> ) {
+      int v = value;
+      m.append( DATA_TYPE::BOOLEAN, &v, sizeof( v ) );
+    } else if constexpr ( std::is_arithmetic_v<T> ) {
+      m.append( Signature<T>::value[0], &value, sizeof( value ) );
+    } else if constexpr ( std::is_base_of_v<std::string, T> ) {
+      m.append( Signature<T>::value[0], value.c_str(), value.size() );
+    } else {
+      m.open( DATA_TYPE::STRUCT, StructContents<T>::value.c_str() );
+      std::apply(
+        [&]( auto... member ) {
+          ( Marshal<typename MemberType<decltype( member )>::type>::write( m, value.*member ),
+            ... );
+        },
+        Describe<T>::members );
+      m.close();
+    }
+  }
+
+  static void read( Reply &r, T &value ) {
+    if constexpr ( std::is_same_v<T, bool> ) {
+      int v = 0;
+      r.extract( DATA_TYPE::BOOLEAN, &v );
+      value = v;
+    } else if constexpr ( std::is_arithmetic_v<T> ) {
+      r.extract( Signature<T>::value[0], &value );
+    } else if constexpr ( std::is_base_of_v<std::string, T> ) {
+      const char *p = nullptr;
+      r.extract( Signature<T>::value[0], &p );
+      value.assign( p );
+    } else {
+      r.enter( DATA_TYPE::STRUCT, StructContents<T>::value.c_str() );
+      std::apply(
+        [&]( auto... member ) {
+          ( Marshal<typename MemberType<decltype( member )>::type>::read( r, value.*member ),
+            ... );
+        },
+        Describe<T>::members );
+      r.exit();
+    }
+  }
+};
+
+template <typename T>
+struct Marshal<std::vector<T>> {
+  static void write( Message &m, const std::vector<T> &value ) {
+    m.open( DATA_TYPE::ARRAY, signatureOf<T>() );
+    for ( const T &v : value )
+      Marshal<T>::write( m, v );
+    m.close();
+  }
+
+  static void read( Reply &r, std::vector<T> &value ) {
+    value.clear();
+    r.enter( DATA_TYPE::ARRAY, signatureOf<T>() );
+    while ( !r.end() ) {
+      value.emplace_back();
+      Marshal<T>::read( r, value.back() );
+    }
+    r.exit();
+  }
+};
+}  // namespace detail
+
+template <typename T>
+struct Signature<T, std::enable_if_t<IsDescribed<T>::value>> {
+  static constexpr auto value =
+    SignatureString<1> { "(" } + detail::StructContents<T>::value + SignatureString<1> { ")" };
+};
+
+}  // namespace dbus
@@ -0,0 +1,135 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/connection.h"
+#include "dbuscpp/message.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signal.h"
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/system/error_code.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Asio front-end:
+ * the bus fd is registered with the io_context as a posix::stream_descriptor and
+ * the bus is processed by whichever thread runs the io_context, no extra threads.
+ * Completion handlers are posted to their associated executor, never invoked inline.
+ * Destroying the AsioManager completes its pending operations with operation_aborted.
+ * Every use of the bus takes its BusLock, so a shared connection can be processed by the
+ * signal loop or Managers meanwhile. Calls go through the flow control of the connection:
+ * a full queue fails them with ENOBUFS or, with FLOW_BLOCK, blocks the calling thread
+ * until it drains; async_writable() waits for room without blocking.
+ */
+
+namespace dbus {
+
+using AsyncHandler = std::function<void( boost::system::error_code, Reply )>;
+using WritableHandler = std::function<void( boost::system::error_code )>;
+
+class AsioManager {
+public:
+  AsioManager( boost::asio::io_context &io, int connectionType = ConnectionType::NEW_SYSTEM_DBUS );
+  AsioManager( const AsioManager &m ) = delete;
+  AsioManager &operator=( const AsioManager &m ) = delete;
+  ~AsioManager();
+
+  Connection &connection();
+
+  Message
+  methodCall( CStringView service, CStringView object, CStringView interface, CStringView member );
+
+  Message
+  propertySet( CStringView service, CStringView object, CStringView interface, CStringView member );
+
+  // installs the match, received signals are queued until async_signal picks them up
+  SignalID subscribe( CStringView rule );
+  void unsubscribe( SignalID id );
+
+  template <typename CompletionToken>
+  auto async_call( Message m, CompletionToken &&token ) {
+    return boost::asio::async_initiate<CompletionToken, void( boost::system::error_code, Reply )>(
+      [this]( auto handler, Message m ) { startCall( m, bindHandler( std::move( handler ) ) ); },
+      token,
+      m );
+  }
+
+  // completes with the reply positioned at the variant
+  template <typename CompletionToken>
+  auto async_property_get( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
+    CompletionToken &&token ) {
+    Message m = methodCall( service, object, "org.freedesktop.DBus.Properties", "Get" );
+    m.write( interface.c_str() );
+    m.write( member.c_str() );
+    return async_call( m, std::forward<CompletionToken>( token ) );
+  }
+
+  // completes with the next signal received for the subscription
+  template <typename CompletionToken>
+  auto async_signal( SignalID id, CompletionToken &&token ) {
+    return boost::asio::async_initiate<CompletionToken, void( boost::system::error_code, Reply )>(
+      [this]( auto handler, SignalID id ) { startSignal( id, bindHandler( std::move( handler ) ) ); },
+      token,
+      id );
+  }
+
+  // completes once the outgoing queue is at or below the low watermarks of the connection
+  template <typename CompletionToken>
+  auto async_writable( CompletionToken &&token ) {
+    return boost::asio::async_initiate<CompletionToken, void( boost::system::error_code )>(
+      [this]( auto handler ) {
+        auto h = std::make_shared<decltype( handler )>( std::move( handler ) );
+        auto ex = boost::asio::get_associated_executor( *h, io.get_executor() );
+        startWritable( [h, ex]( boost::system::error_code ec ) {
+          boost::asio::post( ex, [h, ec]() mutable { std::move( *h )( ec ); } );
+        } );
+      },
+      token );
+  }
+
+private:
+  struct Shared;
+  struct CallContext;
+  struct SignalContext;
+
+  template <typename Handler>
+  AsyncHandler bindHandler( Handler handler ) {
+    auto h = std::make_shared<Handler>( std::move( handler ) );
+    auto ex = boost::asio::get_associated_executor( *h, io.get_executor() );
+    return [h, ex]( boost::system::error_code ec, Reply reply ) {
+      boost::asio::post( ex, [h, ec, reply]() mutable { std::move( *h )( ec, reply ); } );
+    };
+  }
+
+  void startCall( const Message &m, AsyncHandler handler );
+  void startSignal( SignalID id, AsyncHandler handler );
+  void startWritable( WritableHandler handler );
+  void process();
+  void arm();
+  static void resume( const std::shared_ptr<Shared> &shared, bool AsioManager::*pending );
+
+  boost::asio::io_context &io;
+  Connection conn;
+  boost::asio::posix::stream_descriptor descriptor;
+  boost::asio::steady_timer timer;
+  std::shared_ptr<Shared> shared;
+  std::map<void *, std::unique_ptr<CallContext>> calls;  // by slot, guarded by the bus lock
+  std::map<SignalID, std::unique_ptr<SignalContext>> subscriptions;
+  std::vector<WritableHandler> writableWaiters;
+
+  bool readPending = false;
+  bool writePending = false;
+  uint64_t deadline = UINT64_MAX;
+};
+}  // namespace dbus
@@ -0,0 +1,91 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/connection.h"
+#include "dbuscpp/message.h"
+#include "dbuscpp/reply.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <variant>
+
+namespace dbus {
+
+class Manager;
+
+// value of a basic-typed property, std::monostate when the type is not basic
+using PropertyValue = std::variant<std::monostate,
+  bool,
+  uint8_t,
+  int16_t,
+  uint16_t,
+  int32_t,
+  uint32_t,
+  int64_t,
+  uint64_t,
+  double,
+  std::string,
+  ObjectPath>;
+
+struct PropertyRequest {
+  std::string service;
+  std::string object;
+  std::string interface;
+  std::string member;
+  PropertyValue value;  // only used by propertySetBatch
+};
+
+struct BatchResult {
+  Reply reply;
+  PropertyValue value;  // decoded variant, filled by propertyGetBatch
+  int error = 0;        // errno, 0 on success
+  std::string errorMessage;
+  std::string errorName;  // of an error reply, e.g. org.freedesktop.DBus.Error.AccessDenied
+
+  bool ok() const {
+    return error == 0;
+  }
+};
+
+/* Fire-and-forget scope:
+ *   {
+ *     SendBatch batch { manager };
+ *     for ( auto &actuator : actuators )
+ *       batch.propertySet( "com.example", actuator.path, "com.example.Actuator", "Level", level );
+ *   }  // one flush here
+ * Messages are sent without expecting a reply and the bus stays locked for the
+ * whole scope, so nothing is interleaved. Errors reported by the peer are dropped.
+ * The lock is recursive: the same thread may go on using the Manager inside the scope,
+ * a call() writes out what the batch queued and then waits for its own reply. Other
+ * threads and the event loop of a shared bus wait for the end of the scope, so nothing
+ * in it may wait for them, e.g. SignalGroup::synchronize() or a signal callback.
+ */
+class SendBatch {
+public:
+  SendBatch( Manager &manager );
+  SendBatch( const SendBatch &other ) = delete;
+  SendBatch &operator=( const SendBatch &rhs ) = delete;
+  ~SendBatch();  // flushes what is still queued
+
+  void send( const Message &m );
+  void propertySet( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
+    const PropertyValue &value );
+  void flush();
+
+  std::size_t size() const;  // messages sent in this scope
+
+private:
+  Manager &manager;
+  BusLock lock;
+  std::size_t count = 0;
+};
+
+// writes the value wrapped in a variant
+void writeVariant( Message &m, const PropertyValue &value );
+
+// reads a basic-typed variant, returns false and leaves the reply untouched otherwise
+bool readVariant( Reply &reply, PropertyValue &value );
+
+}  // namespace dbus
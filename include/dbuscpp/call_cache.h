@@ -0,0 +1,82 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/manager.h"
+#include "dbuscpp/message.h"
+#include "dbuscpp/name_owner_cache.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signal.h"
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dbus {
+
+/* Opt-in memoization of idempotent calls (Introspect, GetManagedObjects, ...):
+ * replies are keyed by destination, path, interface, member and arguments, and kept
+ * for the TTL configured for the method. Methods without a TTL go straight to the
+ * Manager. For the others the message is sealed to read its arguments back and a copy
+ * of it is sent, calls with more than 4 KiB of arguments are not kept.
+ * Identical calls issued while one is in flight wait for its reply instead of sending
+ * their own. Every caller gets a copy of the cached reply to decode on its own.
+ * Everything is dropped when the SignalGroup reconnects after a broker restart.
+ */
+class CallCache {
+public:
+  CallCache( Manager &manager );
+  CallCache( const CallCache &other ) = delete;
+  CallCache &operator=( const CallCache &rhs ) = delete;
+  ~CallCache();
+
+  void ttl( CStringView interface, CStringView member, std::chrono::milliseconds ttl );
+
+  // drops the replies from service (all of them when empty) when a signal matches rule
+  void invalidateOn( CStringView rule, CStringView service = "" );
+
+  // drops the replies from a service when its owner changes
+  void invalidateOn( NameOwnerCache &owners );
+
+  Reply call( Message m );  // m cannot be written to afterwards
+
+  void invalidate();
+  void invalidate( CStringView service );
+  std::size_t size();  // expired replies are purged as new ones come in
+
+private:
+  using Key = std::tuple<std::string, std::string, std::string, std::string, std::string>;
+
+  struct Entry {
+    Reply reply;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  struct Flight {
+    std::shared_future<Reply> reply;
+    uint64_t generation;
+  };
+
+  bool arguments( Message &m, std::string &key );
+  Message outgoing( Message &m );
+  Reply copy( Reply &reply );  // mutex must be held
+  void purge( std::chrono::steady_clock::time_point now );  // mutex must be held
+
+  Manager &manager;
+  NameOwnerCache *owners = nullptr;
+  std::size_t ownersCallback = 0;
+  std::size_t reconnectCallback = 0;
+
+  std::map<std::pair<std::string, std::string>, std::chrono::milliseconds> ttls;
+  std::map<Key, Entry> entries;
+  std::map<Key, Flight> inflight;
+  std::vector<SignalID> signals;
+  uint64_t generation = 0;  // of the invalidations, a reply older than one is not kept
+  std::chrono::steady_clock::time_point purged;
+  std::mutex mutex;
+};
+
+}  // namespace dbus
@@ -1,5 +1,8 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace dbus {
@@ -7,7 +10,25 @@ namespace dbus {
 class ObjectPath : public std::string {
 public:
   ObjectPath() : std::string {} {}
-  ObjectPath( std::string objectPath ) : std::string { objectPath } {}
+  ObjectPath( std::string objectPath ) : std::string { std::move( objectPath ) } {}
+};
+
+// non-owning view of a null-terminated string, sd-bus only takes C strings
+class CStringView {
+public:
+  CStringView( const char *str ) : str { str } {}
+  CStringView( const std::string &str ) : str { str.c_str() } {}
+
+  const char *c_str() const {
+    return str;
+  }
+
+  operator std::string_view() const {
+    return std::string_view { str };
+  }
+
+private:
+  const char *str;
 };
 
 enum DATA_TYPE : char {
@@ -37,4 +58,18 @@ enum DATA_TYPE : char {
 
 enum MessageType { INVALID = 0, METHOD_CALL, METHOD_RETURN, METHOD_ERROR, SIGNAL };
 
+// members of a struct marshalled as a D-Bus struct, specialized by DBUSCPP_STRUCT (aggregate.h)
+template <typename T>
+struct Describe;
+
+template <typename T, typename = void>
+struct IsDescribed : std::false_type {};
+template <typename T>
+struct IsDescribed<T, std::void_t<decltype( Describe<T>::members )>> : std::true_type {};
+
+namespace detail {
+template <typename T>
+struct Marshal;
+}  // namespace detail
+
 }  // namespace dbus
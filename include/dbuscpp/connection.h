@@ -1,15 +1,52 @@
 #pragma once
 #include "dbuscpp/common.h"
 #include <chrono>
-#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
 
 namespace dbus {
-enum ConnectionType { REUSE_SYSTEM_DBUS = 0, NEW_SYSTEM_DBUS };
+// SHARED_SYSTEM_DBUS: the process wide bus of the ConnectionRegistry, opened on first use
+enum ConnectionType { REUSE_SYSTEM_DBUS = 0, NEW_SYSTEM_DBUS, SHARED_SYSTEM_DBUS };
+// MONITOR: never answers what it sees, for BecomeMonitor (see Monitor),
+// only for new connections since the shared bus is already started
+enum ConnectionOption { NO_OPTIONS = 0, MONITOR = 1 };
+enum FlowPolicy { FLOW_BLOCK = 0, FLOW_FAIL };
+
+// outgoing queue limits, a zero watermark disables that limit
+struct FlowControl {
+  std::size_t highMessages = 0;  // producers are held back above these
+  std::size_t highBytes = 0;
+  std::size_t lowMessages = 0;  // and writable again at or below these
+  std::size_t lowBytes = 0;
+  int policy = FlowPolicy::FLOW_BLOCK;
+};
+
+struct FlowStats {
+  std::size_t queuedMessages = 0;
+  std::size_t queuedBytes = 0;  // estimated, of the messages sent through this connection
+  uint64_t blocked = 0;         // producers that had to wait for the queue to drain
+  uint64_t rejected = 0;        // producers turned away by FLOW_FAIL
+};
+
+struct BusState;
+class Recorder;
+
+// copies share the bus and its flow control, the last one closes it
 class Connection {
 public:
-  Connection( int connectionType = ConnectionType::NEW_SYSTEM_DBUS);
+  Connection( int connectionType = ConnectionType::NEW_SYSTEM_DBUS,
+    int options = ConnectionOption::NO_OPTIONS );
+  // a bus at another address, e.g. the unix:path=... of a private dbus-daemon
+  explicit Connection( CStringView address, int options = ConnectionOption::NO_OPTIONS );
+  // takes over a reference to a started sd_bus, e.g. a peer-to-peer one; it has no
+  // address to reconnect to
+  static Connection adopt( void *bus );
   Connection( const Connection &c );
+  Connection( Connection &&c ) noexcept;
   Connection &operator=( const Connection &rhs );
+  Connection &operator=( Connection &&rhs ) noexcept;
   ~Connection();
 
   std::string address();
@@ -17,12 +54,62 @@ public:
   bool ready();
   std::chrono::microseconds timeout();
 
+  void flowControl( const FlowControl &limits );
+  FlowStats flowStats();
+  std::size_t queuedMessages();
+  std::size_t queuedBytes();
+  bool writable();  // at or below the low watermarks
+
+  // before queueing a message, takes the bus lock: returns at once below the high watermarks,
+  // otherwise throws or blocks until the queue is down to the low watermarks
+  void admit( std::size_t size );
+  // after the message was handed to sd-bus
+  void sent( std::size_t size );
+
+  // drops the bus and opens a new one for all copies, e.g. after the broker restarted;
+  // matches and pending calls of the old bus are gone
+  void reconnect();
+  // false when reconnect() has nothing to reopen: the thread default or an adopted bus
+  bool reopenable();
+
+  // every message sent through a Manager or SignalEmitter on this bus and every one
+  // received is appended to the recorder, nullptr stops recording
+  void record( std::shared_ptr<Recorder> recorder );
+
+  // readable when other threads left incoming messages on a shared bus, -1 otherwise
+  int wakeDescriptor();
+
   void *borrowBusObject();
 
 private:
-  void *bus = nullptr;
-  std::mutex mutex;
+  friend class BusLock;
+  friend class ConnectionRegistry;
+  friend class Manager;
+  friend class SendBatch;
+  friend class SignalEmitter;
+
+  explicit Connection( std::shared_ptr<BusState> state );
+  std::size_t drained( std::size_t untracked = 0 );
+  bool tracing() noexcept;
+  // hands a sealed message to the recorder, if there is one; never fails the caller
+  void trace( void *message, int direction, uint64_t timestamp = 0 ) noexcept;
+
+  std::shared_ptr<BusState> state;
 
 };  // class Connection
 
+// exclusive use of the bus across threads; a shared bus wakes its event loop on release
+// when the holder read messages the loop has to dispatch
+class BusLock {
+public:
+  explicit BusLock( Connection &c, bool wake = true );
+  BusLock( const BusLock &other ) = delete;
+  BusLock &operator=( const BusLock &rhs ) = delete;
+  ~BusLock();
+
+private:
+  std::shared_ptr<BusState> state;
+  bool wake;
+};
+
 }  // namespace dbus
@@ -0,0 +1,27 @@
+#pragma once
+#include "dbuscpp/connection.h"
+
+/* One system bus connection per process:
+ *   ConnectionRegistry::preconnect();  // optional, starts the handshake early
+ *   Manager manager;                   // SHARED_SYSTEM_DBUS by default
+ *   SignalGroup group;                 // listens on the same bus
+ * The bus is opened on first use and sd-bus authenticates asynchronously, so the first
+ * call is queued behind the handshake instead of waiting for it. Threads take turns on
+ * the bus with a BusLock; signals read by a caller are handed to the signal loop, which
+ * runs the callbacks after releasing the lock, so a slow callback never holds up a call.
+ */
+
+namespace dbus {
+
+class ConnectionRegistry {
+public:
+  static Connection system();
+  // opens the shared bus now, without waiting for the handshake
+  static void preconnect();
+  // the next system() gets a new bus, current users keep the old one until they let go
+  static void reset();
+  // Connection handles on the shared bus, 0 when none was made
+  static long users();
+};
+
+}  // namespace dbus
@@ -0,0 +1,118 @@
+#pragma once
+// <utility> must precede asio, boost 1.74 awaitable.hpp uses std::exchange without including it
+#include <utility>
+#include "dbuscpp/asio_manager.h"
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <string>
+
+/* C++20 coroutine front-end on top of AsioManager:
+ * every operation suspends the coroutine until the bus delivers the reply and
+ * resumes it on the coroutine's own executor, no thread is blocked meanwhile.
+ * Failures are thrown as boost::system::system_error.
+ * Requires the consumer to build with -std=c++20.
+ */
+
+#if defined( BOOST_ASIO_HAS_CO_AWAIT )
+
+namespace dbus {
+
+namespace detail {
+inline char variantType( bool ) {
+  return DATA_TYPE::BOOLEAN;
+}
+inline char variantType( int16_t ) {
+  return DATA_TYPE::INT16;
+}
+inline char variantType( int32_t ) {
+  return DATA_TYPE::INT32;
+}
+inline char variantType( int64_t ) {
+  return DATA_TYPE::INT64;
+}
+inline char variantType( double ) {
+  return DATA_TYPE::DOUBLE;
+}
+inline char variantType( const std::string & ) {
+  return DATA_TYPE::STRING;
+}
+inline char variantType( const ObjectPath & ) {
+  return DATA_TYPE::OBJECT_PATH;
+}
+}  // namespace detail
+
+inline boost::asio::awaitable<Reply> call( AsioManager &manager, Message m ) {
+  co_return co_await manager.async_call( m, boost::asio::use_awaitable );
+}
+
+// the reply is positioned at the variant
+inline boost::asio::awaitable<Reply> propertyGet( AsioManager &manager,
+  std::string service,
+  std::string object,
+  std::string interface,
+  std::string member ) {
+  co_return co_await manager.async_property_get(
+    service, object, interface, member, boost::asio::use_awaitable );
+}
+
+template <typename T>
+boost::asio::awaitable<T> propertyGetDirect( AsioManager &manager,
+  std::string service,
+  std::string object,
+  std::string interface,
+  std::string member ) {
+  T value {};
+  Reply reply = co_await propertyGet( manager, service, object, interface, member );
+  reply.enterContainer( DATA_TYPE::VARIANT, detail::variantType( value ) );
+  reply.read( value );
+  reply.exitContainer();
+  co_return value;
+}
+
+template <typename T>
+boost::asio::awaitable<void> propertySetDirect( AsioManager &manager,
+  std::string service,
+  std::string object,
+  std::string interface,
+  std::string member,
+  T value ) {
+  Message m = manager.propertySet( service, object, interface, member );
+  m.openContainer( DATA_TYPE::VARIANT, detail::variantType( value ) );
+  m.write( value );
+  m.closeContainer();
+  co_await manager.async_call( m, boost::asio::use_awaitable );
+}
+
+/* Stream of the signals matching a rule:
+ *   SignalStream stream( manager, "type='signal',member='PropertiesChanged'" );
+ *   for ( ;; ) {
+ *     Reply signal = co_await stream.next();
+ *   }
+ * Signals arriving between two next() calls are queued, none is lost.
+ */
+class SignalStream {
+public:
+  SignalStream( AsioManager &manager, std::string rule )
+    : manager( manager ), id( manager.subscribe( rule ) ) {}
+  SignalStream( const SignalStream &other ) = delete;
+  SignalStream &operator=( const SignalStream &rhs ) = delete;
+  ~SignalStream() {
+    manager.unsubscribe( id );
+  }
+
+  boost::asio::awaitable<Reply> next() {
+    co_return co_await manager.async_signal( id, boost::asio::use_awaitable );
+  }
+
+  SignalID uuid() {
+    return id;
+  }
+
+private:
+  AsioManager &manager;
+  SignalID id;
+};
+
+}  // namespace dbus
+
+#endif  // BOOST_ASIO_HAS_CO_AWAIT
@@ -1,8 +1,23 @@
 #pragma once
+#include "dbuscpp/aggregate.h"
+#include "dbuscpp/batch.h"
+#include "dbuscpp/call_cache.h"
 #include "dbuscpp/common.h"
 #include "dbuscpp/connection.h"
+#include "dbuscpp/connection_registry.h"
+#include "dbuscpp/latency.h"
+#include "dbuscpp/loopback.h"
 #include "dbuscpp/manager.h"
 #include "dbuscpp/message.h"
+#include "dbuscpp/monitor.h"
+#include "dbuscpp/name_owner_cache.h"
+#include "dbuscpp/property_schema.h"
+#include "dbuscpp/property_watcher.h"
+#include "dbuscpp/recorder.h"
 #include "dbuscpp/reply.h"
+#include "dbuscpp/reply_range.h"
 #include "dbuscpp/signal.h"
+#include "dbuscpp/signal_emitter.h"
 #include "dbuscpp/signal_group.h"
+#include "dbuscpp/signature.h"
+#include "dbuscpp/type_tree.h"
@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace dbus {
+
+/* Lock-free histogram of latencies in microseconds with power-of-two buckets:
+ * bucket 0 counts 0 µs, bucket i counts [2^(i-1), 2^i) µs, the last one everything above.
+ * Recording is a few relaxed atomic increments, safe from the loop thread while
+ * other threads read.
+ */
+class LatencyHistogram {
+public:
+  static constexpr std::size_t BUCKETS = 32;
+
+  LatencyHistogram() = default;
+  LatencyHistogram( const LatencyHistogram &other ) = delete;
+  LatencyHistogram &operator=( const LatencyHistogram &rhs ) = delete;
+
+  void record( uint64_t usec );
+  void reset();
+
+  uint64_t count() const;
+  uint64_t max() const;
+  double mean() const;
+  // upper bound of the bucket holding the p-th percentile, p in [0, 1]
+  uint64_t percentile( double p ) const;
+  std::array<uint64_t, BUCKETS> buckets() const;
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKETS> m_buckets {};
+  std::atomic<uint64_t> m_count { 0 };
+  std::atomic<uint64_t> m_sum { 0 };
+  std::atomic<uint64_t> m_max { 0 };
+};
+
+struct SignalLatency {
+  // read off the socket to callback start: the signals queued ahead of it and the time
+  // the loop waited for the bus
+  LatencyHistogram queue;
+  // time spent in the registered callbacks
+  LatencyHistogram callback;
+};
+
+}  // namespace dbus
@@ -0,0 +1,87 @@
+#pragma once
+#include "dbuscpp/batch.h"
+#include "dbuscpp/common.h"
+#include "dbuscpp/connection.h"
+#include "dbuscpp/message.h"
+#include "dbuscpp/reply.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+/* In-process peer for tests and benchmarks, no dbus-daemon and no privileges needed:
+ *   LoopbackService service;
+ *   service.property( "com.example.Sensor", "Level", 42.0 );
+ *   service.method( "com.example.Sensor", "Reset", []( Reply &call, Message &reply ) {} );
+ *   Manager manager { service.connection() };
+ *   manager.propertyGet( "com.example", "/com/example/sensor0", "com.example.Sensor", "Level" );
+ *   SignalGroup::useConnection( service.connection() );  // before SignalGroup::start
+ * The two ends are a peer-to-peer socketpair: any destination and object path reaches the
+ * service, which answers on its own thread right away, or after the configured delay.
+ * org.freedesktop.DBus.Properties is served from the property table, a Set sends
+ * PropertiesChanged. Matches are evaluated by the client's sd-bus, as on any peer bus.
+ */
+
+namespace dbus {
+
+// call arguments in, reply arguments out; an exception becomes an error reply
+using MethodHandler = std::function<void( Reply &call, Message &reply )>;
+
+class LoopbackService {
+public:
+  // Echo on this interface replies with the arguments it was called with
+  static constexpr const char *INTERFACE = "org.dbuscpp.Loopback";
+
+  LoopbackService();  // the service thread runs until destruction
+  LoopbackService( const LoopbackService &other ) = delete;
+  LoopbackService &operator=( const LoopbackService &rhs ) = delete;
+  ~LoopbackService();
+
+  // client end, all copies share it
+  Connection connection();
+
+  void method( CStringView interface, CStringView member, MethodHandler handler );
+  void property( CStringView interface, CStringView name, const PropertyValue &value );
+  PropertyValue property( CStringView interface, CStringView name );
+
+  // service time added before every reply
+  void delay( std::chrono::microseconds delay );
+
+  // signals from the service to the client
+  Message signal( CStringView object, CStringView interface, CStringView member );
+  void emit( const Message &signal );
+
+  uint64_t calls();  // method calls answered
+
+private:
+  using Key = std::pair<std::string, std::string>;
+
+  explicit LoopbackService( std::array<int, 2> fds );
+  static int dispatch( void *message, void *userdata );
+  // server bus lock must be held
+  void serve( void *call );
+  void properties( void *call );  // Get, GetAll and Set
+  void loop();
+
+  Connection client;
+  Connection server;
+  void *filter = nullptr;
+  int wakeFd = -1;  // emit() has queued a signal
+
+  std::map<Key, MethodHandler> handlers;
+  std::map<Key, PropertyValue> values;
+  std::mutex mutex;
+
+  std::atomic<int64_t> delayUsec { 0 };
+  std::atomic<uint64_t> served { 0 };
+  std::atomic<bool> stopRequest { false };
+  std::thread thread;
+};
+
+}  // namespace dbus
@@ -1,116 +1,165 @@
 #pragma once
+#include "dbuscpp/batch.h"
 #include "dbuscpp/common.h"
 #include "dbuscpp/connection.h"
 #include "dbuscpp/manager.h"
 #include "dbuscpp/message.h"
 #include "dbuscpp/reply.h"
+#include "dbuscpp/reply_range.h"
 #include <functional>
-#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dbus {
+
+// one managed object: its path and a lazy range over interface name -> a{sv} of properties,
+// return false to stop, whatever the visitor does not read is skipped
+using ObjectVisitor =
+  std::function<bool( const ObjectPath &object, DictRange<std::string_view> &interfaces )>;
+
 class Manager {
 public:
-  Manager();
+  Manager();  // on the shared bus of the ConnectionRegistry
   Manager( int connectionType );
+  explicit Manager( const Connection &connection );  // e.g. a LoopbackService peer
   Manager( const Manager &m );
+  Manager( Manager &&m ) noexcept;
   Manager &operator=( const Manager &m );
+  Manager &operator=( Manager &&m ) noexcept;
+
+  // flow control and queue gauges of the outgoing side
+  Connection &connection();
 
   Message
-  methodCall( std::string service, std::string object, std::string interface, std::string member );
+  methodCall( CStringView service, CStringView object, CStringView interface, CStringView member );
 
   Reply
-  propertyGet( std::string service, std::string object, std::string interface, std::string member );
+  propertyGet( CStringView service, CStringView object, CStringView interface, CStringView member );
+
+  // a{sv} of every property of the interface, see PropertySchema::decode
+  Reply propertyGetAll( CStringView service, CStringView object, CStringView interface );
 
   Message
-  propertySet( std::string service, std::string object, std::string interface, std::string member );
+  propertySet( CStringView service, CStringView object, CStringView interface, CStringView member );
+
+  Reply call( const Message &m );
 
-  Reply call( Message m );
+  // no reply is expected nor waited for, the message is flushed before returning, see SendBatch
+  void send( const Message &m );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     bool &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int16_t &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int32_t &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int64_t &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     double &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     std::string &value );
 
-  void propertyGetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertyGetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     ObjectPath &value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     bool value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int16_t value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int32_t value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     int64_t value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
     double value );
 
-  void propertySetDirect( std::string service,
-    std::string object,
-    std::string interface,
-    std::string member,
-    std::string value );
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
+    std::string_view value );
+
+  // without it a string literal would pick the bool overload
+  void propertySetDirect( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member,
+    const char *value );
+
+  // all messages are sent before waiting, results come back in the order of the requests;
+  // on a shared bus, signals arriving meanwhile are dispatched by the waiting thread
+  std::vector<BatchResult> callBatch( const std::vector<Message> &messages );
+
+  // basic-typed values are decoded into BatchResult::value,
+  // other replies are left positioned at the variant
+  std::vector<BatchResult> propertyGetBatch( const std::vector<PropertyRequest> &requests );
+
+  std::vector<BatchResult> propertySetBatch( const std::vector<PropertyRequest> &requests );
 
   // the service must implement DBus org.freedesktop.DBus.ObjectManager
-  std::vector<ObjectPath> objects( std::string service );
+  std::vector<ObjectPath> objects( CStringView service );
+
+  // decodes GetManagedObjects as it goes, nothing is copied out of the reply,
+  // returns the number of objects visited
+  std::size_t objects( CStringView service, const ObjectVisitor &visitor );
 
 private:
-  std::mutex mutex;
+  friend class SendBatch;
+  // bus lock must be held
+  Message newMethodCall( CStringView service,
+    CStringView object,
+    CStringView interface,
+    CStringView member );
+  void enqueue( const Message &m );
+  void flush();
+
   Connection conn;
 };
 }  // namespace dbus
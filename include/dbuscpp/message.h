@@ -1,8 +1,12 @@
 #pragma once
 #include "dbuscpp/common.h"
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 namespace dbus {
 
@@ -11,19 +15,21 @@ public:
   Message();
   Message( void *message );
   Message( const Message &other );
+  Message( Message &&other ) noexcept;
   ~Message();
 
   Message &operator=( const Message &rhs );
+  Message &operator=( Message &&rhs ) noexcept;
 
   int type();
   bool empty();
-  bool signatureValid( std::string signature );
+  bool signatureValid( std::string_view signature );
   char signatureType();
-  bool hasSignature( std::string signature );
+  bool hasSignature( CStringView signature );
   std::string signatureContents();
 
   void openContainer( char type, char content );
-  void openContainer( char type, std::string contents );
+  void openContainer( char type, CStringView contents );
   void closeContainer();
 
   std::string sender();
@@ -41,15 +47,46 @@ public:
   void write( uint32_t value );
   void write( uint64_t value );
   void write( double value );
-  void write( std::string value );
-  void write( std::vector<std::byte> value );
-  void write( ObjectPath objectPath );
+  void write( std::string_view value );
+  void write( const char *value );
+  void write( const std::string &value );
+  void write( const std::vector<std::byte> &value );
+  void write( const ObjectPath &objectPath );
+
+  // structs described with DBUSCPP_STRUCT and arrays of them, marshalled under a single lock
+  template <typename T, typename = std::enable_if_t<IsDescribed<T>::value>>
+  void write( const T &value ) {
+    std::lock_guard<std::mutex> lock( mutex );
+    detail::Marshal<T>::write( *this, value );
+  }
+
+  template <typename T, typename = std::enable_if_t<IsDescribed<T>::value>>
+  void write( const std::vector<T> &value ) {
+    std::lock_guard<std::mutex> lock( mutex );
+    detail::Marshal<std::vector<T>>::write( *this, value );
+  }
+
+  // estimate of the size on the wire: the fixed header, the header fields that are set
+  // and the argument data written so far, without the padding between arguments
+  std::size_t size() const;
 
 private:
   friend class Manager;
-  void *borrowBusMessage();
+  friend class AsioManager;
+  friend class CallCache;
+  friend class LoopbackService;
+  friend class SignalEmitter;
+  template <typename T>
+  friend struct detail::Marshal;
+  void *borrowBusMessage() const;
+
+  // unlocked primitives for detail::Marshal, the caller holds the mutex
+  void append( char type, const void *value, std::size_t size );
+  void open( char type, const char *contents );
+  void close();
 
   void *msg = nullptr;
+  std::size_t m_size = 0;  // argument bytes written
   std::mutex mutex;
 };
 }  // namespace dbus
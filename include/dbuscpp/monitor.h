@@ -0,0 +1,74 @@
+#pragma once
+#include "dbuscpp/connection.h"
+#include "dbuscpp/reply.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Always-on flight recorder of bus traffic:
+ *   Monitor monitor( 8192 );
+ *   monitor.start( { "type='method_call',destination='org.freedesktop.systemd1'" } );
+ *   ...
+ *   monitor.drain( []( Reply &m ) { ... } );  // decoded only here
+ * BecomeMonitor hands us a copy of whatever the rules match, so nothing is filtered on
+ * our side. The monitor thread keeps a reference to each message in a fixed ring,
+ * the newest overwriting the oldest; no field is read before it is inspected. The
+ * ring survives stop(), for a look after the fact. Every message references the
+ * monitor's bus, whose reference count is not atomic, so drained messages are visited
+ * under the lock the monitor thread processes the bus with and released right after:
+ * copy out what has to outlive the visit. BecomeMonitor needs the privileges the bus
+ * policy gives to monitors, usually root.
+ */
+
+namespace dbus {
+
+class Monitor {
+public:
+  explicit Monitor( std::size_t capacity = 4096 );  // rounded up to a power of two
+  Monitor( const Monitor &other ) = delete;
+  Monitor &operator=( const Monitor &rhs ) = delete;
+  ~Monitor();
+
+  // match rules applied by the broker, none for all traffic
+  void start( const std::vector<std::string> &rules = {} );
+  void stop();
+  bool running();
+
+  // takes the messages out of the ring and visits them, oldest first; the monitor thread
+  // waits meanwhile. Returns the number of messages visited.
+  std::size_t drain( const std::function<void( Reply &message )> &visit );
+
+  std::size_t capacity() const;
+  uint64_t captured() const;     // since construction
+  uint64_t overwritten() const;  // lost to newer messages before a drain
+
+private:
+  static int filter( void *message, void *userdata );
+  void loop();
+  void publish();  // monitor thread only
+
+  std::unique_ptr<std::atomic<void *>[]> slots;
+  std::size_t mask = 0;
+  std::atomic<uint64_t> head { 0 };  // written by the monitor thread only
+  uint64_t tail = 0;                 // next to drain, under drainMutex
+  std::mutex drainMutex;             // also keeps stop() from dropping the connection
+
+  // referenced during sd_bus_process, moved to the ring once sd-bus let go of them
+  std::vector<void *> pending;
+  std::atomic<uint64_t> m_captured { 0 };
+  std::atomic<uint64_t> m_overwritten { 0 };
+
+  std::unique_ptr<Connection> conn;
+  void *filterSlot = nullptr;
+  std::string uniqueName;
+  std::atomic<bool> stopRequest { false };
+  std::thread thread;
+};
+
+}  // namespace dbus
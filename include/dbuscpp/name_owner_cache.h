@@ -0,0 +1,63 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/manager.h"
+#include "dbuscpp/signal_group.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace dbus {
+
+// name, previous unique owner, new unique owner (empty when the name has no owner)
+using OwnerChangedCallback = std::function<void(
+  const std::string &name, const std::string &oldOwner, const std::string &newOwner )>;
+
+/* Resolves well-known names to unique connection names:
+ * the first resolve() subscribes to NameOwnerChanged for that name, waits until the
+ * broker accepted the match and then asks it (GetNameOwner); later ones are answered from
+ * the cache. An answer is not cached while the match is not in place, e.g. when
+ * resolve() runs on the SignalGroup thread itself.
+ * Owner changes are reported to the registered callbacks, a change from one
+ * non-empty owner to another means the service restarted.
+ * The callbacks run on the SignalGroup thread, which is started if needed.
+ * Unique names do not survive a broker restart, the cache is cleared on reconnect.
+ */
+class NameOwnerCache {
+public:
+  NameOwnerCache( Manager &manager );
+  NameOwnerCache( const NameOwnerCache &other ) = delete;
+  NameOwnerCache &operator=( const NameOwnerCache &rhs ) = delete;
+  ~NameOwnerCache();
+
+  // unique name owning the name, empty when the name has no owner; any other failure to
+  // ask the broker throws and leaves the name unresolved
+  std::string resolve( CStringView name );
+
+  // match rule fragment restricting a rule to the current owner: sender='<unique name>'
+  std::string senderRule( CStringView name );
+
+  void invalidate( CStringView name );
+  void clear();
+
+  std::size_t registerOwnerChanged( OwnerChangedCallback callback );
+  void unregisterOwnerChanged( std::size_t id );
+
+private:
+  struct Entry {
+    std::string owner;
+    SignalID signal;
+    bool resolved = false;
+  };
+
+  void ownerChanged( Reply &message );
+
+  Manager &manager;
+  std::map<std::string, Entry> names;
+  std::map<std::size_t, OwnerChangedCallback> callbacks;
+  std::size_t nextCallbackId = 0;
+  std::size_t reconnectCallback = 0;
+  std::mutex mutex;
+};
+
+}  // namespace dbus
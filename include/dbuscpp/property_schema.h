@@ -0,0 +1,141 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signature.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+/* Compile-time schema of a property dictionary (a{sv}):
+ *   struct Device { std::string alias; int16_t rssi; bool connected; };
+ *   static constexpr auto deviceSchema = makeSchema<Device>(
+ *     property( "Alias", &Device::alias ),
+ *     property( "RSSI", &Device::rssi ),
+ *     property( "Connected", &Device::connected ) );
+ *   deviceSchema.decode( reply, device );
+ * The names are placed in a perfect hash table built by the compiler, so decoding
+ * costs one hash and one name comparison per key. Unknown keys are skipped and the
+ * variant type is checked by a single enter with the expected signature.
+ */
+
+namespace dbus {
+
+template <typename C, typename M>
+struct PropertyField {
+  std::string_view name;
+  M C::*member;
+};
+
+template <typename C, typename M>
+constexpr PropertyField<C, M> property( std::string_view name, M C::*member ) {
+  return PropertyField<C, M> { name, member };
+}
+
+namespace detail {
+constexpr uint32_t schemaHash( std::string_view s, uint32_t seed ) {
+  uint32_t h = 2166136261u ^ ( seed * 16777619u );
+  for ( char c : s ) {
+    h ^= static_cast<uint8_t>( c );
+    h *= 16777619u;
+  }
+  return h ^ ( h >> 15 );
+}
+
+constexpr std::size_t schemaTableSize( std::size_t n ) {
+  std::size_t size = 1;
+  while ( size < 2 * n )
+    size *= 2;
+  return size;
+}
+}  // namespace detail
+
+template <typename C, typename... M>
+class PropertySchema {
+public:
+  static constexpr std::size_t size = sizeof...( M );
+  static constexpr std::size_t tableSize = detail::schemaTableSize( size );
+
+  constexpr PropertySchema( PropertyField<C, M>... fields )
+    : fields { fields... }, names { fields.name... } {
+    static_assert( size < 255, "too many properties in one schema" );
+    // smallest seed that maps every name to its own slot,
+    // fails to compile when there is none, e.g. duplicated names
+    for ( seed = 0;; ++seed ) {
+      if ( seed > 0xffff )
+        throw "no perfect hash for the property names";
+      for ( auto &t : table )
+        t = 0;
+      bool collision = false;
+      for ( std::size_t i = 0; i < size && !collision; ++i ) {
+        std::size_t slot = detail::schemaHash( names[i], seed ) & ( tableSize - 1 );
+        if ( table[slot] )
+          collision = true;
+        else
+          table[slot] = static_cast<uint8_t>( i + 1 );
+      }
+      if ( !collision )
+        break;
+    }
+  }
+
+  // index of the property, -1 when the name is not part of the schema
+  constexpr int find( std::string_view name ) const {
+    uint8_t t = table[detail::schemaHash( name, seed ) & ( tableSize - 1 )];
+    if ( t == 0 || names[t - 1] != name )
+      return -1;
+    return t - 1;
+  }
+
+  // decodes the a{sv} at the reply's position, returns the number of properties set
+  std::size_t decode( Reply &reply, C &object ) const {
+    std::size_t decoded = 0;
+    std::string_view key;
+
+    reply.enterContainer( DATA_TYPE::ARRAY, "{sv}" );
+    while ( reply.enterContainerIf( DATA_TYPE::DICT_ENTRY, "sv" ) ) {
+      reply.read( key );
+      int i = find( key );
+      if ( i >= 0 && readField( reply, object, i, std::index_sequence_for<M...> {} ) )
+        ++decoded;
+      else
+        reply.skip( "v" );
+      reply.exitContainer();
+    }
+    reply.exitContainer();
+    return decoded;
+  }
+
+private:
+  template <std::size_t I>
+  bool readField( Reply &reply, C &object ) const {
+    using T = std::tuple_element_t<I, std::tuple<M...>>;
+    if ( !reply.enterContainerIf( DATA_TYPE::VARIANT, signatureOf<T>() ) )
+      return false;  // unexpected type
+    reply.read( object.*( std::get<I>( fields ).member ) );
+    reply.exitContainer();
+    return true;
+  }
+
+  template <std::size_t... I>
+  bool readField( Reply &reply, C &object, int index, std::index_sequence<I...> ) const {
+    bool read = false;
+    std::ignore = ( ( static_cast<int>( I ) == index ? ( read = readField<I>( reply, object ), true )
+                                                     : false ) ||
+                    ... );
+    return read;
+  }
+
+  std::tuple<PropertyField<C, M>...> fields;
+  std::string_view names[size];
+  uint8_t table[tableSize] = {};
+  uint32_t seed = 0;
+};
+
+template <typename C, typename... M>
+constexpr PropertySchema<C, M...> makeSchema( PropertyField<C, M>... fields ) {
+  return PropertySchema<C, M...> { fields... };
+}
+
+}  // namespace dbus
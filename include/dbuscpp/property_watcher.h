@@ -0,0 +1,82 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signal.h"
+#include "dbuscpp/signature.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/* Typed PropertiesChanged subscriptions:
+ *   PropertyWatcher units( "org.freedesktop.systemd1", "/org/freedesktop/systemd1/unit",
+ *     "org.freedesktop.systemd1.Unit" );
+ *   units.on<std::string_view>( "ActiveState",
+ *     []( const ObjectPath &unit, const std::string_view &state ) { ... } );
+ *   units.start();
+ * The match rule carries sender, path_namespace and arg0=<interface>, so the broker only
+ * forwards changes of that interface below the path. Properties without a handler are
+ * skipped undecoded, as are values whose type does not match the handler.
+ * Handlers run on the SignalGroup thread without the watcher's lock, they may call on()
+ * or stop(). stop() and the destructor wait for a running handler, so a handler must
+ * not destroy its own watcher.
+ */
+
+namespace dbus {
+
+class PropertyWatcher {
+public:
+  // an empty service accepts any sender, "/" watches every object
+  PropertyWatcher( CStringView service, CStringView pathNamespace, CStringView interface );
+  PropertyWatcher( const PropertyWatcher &other ) = delete;
+  PropertyWatcher &operator=( const PropertyWatcher &rhs ) = delete;
+  ~PropertyWatcher();
+
+  template <typename T>
+  void on( CStringView property, std::function<void( const ObjectPath &, const T & )> callback ) {
+    Handler handler;
+    handler.signature = signatureOf<T>();
+    handler.changed = [callback]( const ObjectPath &object, Reply &value ) {
+      T v {};
+      value.read( v );
+      callback( object, v );
+    };
+
+    std::lock_guard<std::mutex> lock( mutex );
+    auto next = std::make_shared<Handlers>( *handlers );
+    next->changed[property.c_str()] = std::move( handler );
+    handlers = std::move( next );
+  }
+
+  // invalidated properties that have a handler, their new value must be asked for
+  void onInvalidated(
+    std::function<void( const ObjectPath &, std::string_view property )> callback );
+
+  const std::string &rule() const;
+  void start();  // adds the match and starts the SignalGroup
+  void stop();
+
+private:
+  struct Handler {
+    const char *signature = nullptr;
+    std::function<void( const ObjectPath &, Reply & )> changed;
+  };
+
+  struct Handlers {
+    std::map<std::string, Handler, std::less<>> changed;
+    std::function<void( const ObjectPath &, std::string_view )> invalidated;
+  };
+
+  void changed( Reply &message );
+
+  std::string match;
+  // replaced as a whole under the mutex, the signal loop runs a snapshot without it
+  std::shared_ptr<const Handlers> handlers = std::make_shared<Handlers>();
+  std::mutex mutex;
+  SignalID signal;
+  bool started = false;
+};
+
+}  // namespace dbus
@@ -0,0 +1,135 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/connection.h"
+#include "dbuscpp/latency.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/* Capture and replay of bus traffic:
+ *   auto recorder = std::make_shared<Recorder>( "/tmp/traffic.rec" );
+ *   manager.connection().record( recorder );  // the SignalGroup shares the bus
+ *   ...
+ *   Recording recording( "/tmp/traffic.rec" );
+ *   Connection target( "unix:path=/tmp/test-bus" );  // a private dbus-daemon
+ *   Replayer replayer( recording, target );
+ *   replayer.run( 10.0 );  // ten times faster, 0 for as fast as possible
+ *   replayer.latency().percentile( 0.99 );
+ * The file is a 16 byte header followed by 8 byte aligned records: a RecordHeader, the
+ * header fields and the body as a token stream, readable in place through mmap. Values
+ * are in host byte order. Unix fds cannot be recorded, such messages keep no body and
+ * are not replayed.
+ */
+
+namespace dbus {
+
+enum RecordDirection { RECORD_SENT = 0, RECORD_RECEIVED };
+enum RecordFlags { RECORD_NO_BODY = 1 };
+
+struct RecordHeader {
+  uint32_t size;  // of the whole record, padding included
+  uint8_t direction;
+  uint8_t type;  // sd-bus message type
+  uint8_t flags;
+  uint8_t reserved;
+  uint64_t timestamp;  // steady clock, nanoseconds
+  uint64_t cookie;
+  uint64_t replyCookie;
+};
+
+// one record, the views point into the mapped file and are null-terminated
+struct RecordView {
+  const RecordHeader *header = nullptr;
+  std::string_view destination;
+  std::string_view sender;
+  std::string_view path;
+  std::string_view interface;
+  std::string_view member;
+  std::string_view signature;
+  const uint8_t *body = nullptr;
+  std::size_t bodySize = 0;
+};
+
+/* Appends messages to a recording, see Connection::record.
+ * Recording never fails the traffic it watches: once a write fails (a full disk, ...)
+ * the recording ends there, later messages are counted as dropped.
+ */
+class Recorder {
+public:
+  explicit Recorder( CStringView file );  // truncates the file
+  Recorder( const Recorder &other ) = delete;
+  Recorder &operator=( const Recorder &rhs ) = delete;
+  ~Recorder();  // writes out what is buffered
+
+  static uint64_t now();  // steady clock in nanoseconds, the timestamp of the records
+
+  // sealed sd_bus_message, read from its start and rewound again, timestamp 0 means now
+  void record( void *message, int direction, uint64_t timestamp = 0 ) noexcept;
+  void flush();  // throws when the recording failed
+  uint64_t records();
+  uint64_t bytes();
+  uint64_t dropped();  // records lost to a failed write, or that could not be built
+  int error();         // errno of the failed write, 0 while the recording works
+
+private:
+  void write() noexcept;  // mutex must be held
+
+  int fd = -1;
+  std::string buffer;
+  uint64_t count = 0;
+  uint64_t buffered = 0;  // records in the buffer
+  uint64_t written = 0;
+  uint64_t lost = 0;
+  int failure = 0;
+  std::mutex mutex;
+};
+
+// a recording mapped read-only, a record cut short by a crash ends it
+class Recording {
+public:
+  static constexpr std::size_t FIRST = 16;  // offset of the first record
+
+  explicit Recording( CStringView file );
+  Recording( const Recording &other ) = delete;
+  Recording &operator=( const Recording &rhs ) = delete;
+  ~Recording();
+
+  // reads the record at offset and moves offset to the next one, false at the end
+  bool next( std::size_t &offset, RecordView &record ) const;
+  std::size_t size() const;  // number of records
+
+private:
+  const uint8_t *data = nullptr;
+  std::size_t mapped = 0;
+  std::size_t length = 0;  // up to the end of the last complete record
+  std::size_t count = 0;
+};
+
+struct ReplayStats {
+  uint64_t calls = 0;
+  uint64_t signals = 0;
+  uint64_t errors = 0;   // failed calls and messages that could not be rebuilt
+  uint64_t skipped = 0;  // recorded without a body
+  std::chrono::nanoseconds elapsed { 0 };
+};
+
+// sends the recorded method calls and signals again, replies are left to the target
+class Replayer {
+public:
+  Replayer( const Recording &recording, Connection &target );
+
+  // speed 1 keeps the recorded pacing, N is N times faster, 0 does not wait at all
+  ReplayStats run( double speed = 1.0 );
+  // round trip of the replayed method calls in microseconds
+  const LatencyHistogram &latency() const;
+
+private:
+  const Recording &recording;
+  Connection &target;
+  LatencyHistogram m_latency;
+};
+
+}  // namespace dbus
@@ -1,8 +1,13 @@
 #pragma once
 #include "dbuscpp/common.h"
+#include "dbuscpp/type_tree.h"
 #include <cstddef>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 namespace dbus {
 
@@ -11,22 +16,28 @@ public:
   Reply();
   Reply( void *message );
   Reply( const Reply &other );
+  Reply( Reply &&other ) noexcept;
   Reply &operator=( const Reply &rhs );
+  Reply &operator=( Reply &&rhs ) noexcept;
   ~Reply();
 
   int type();
   bool empty();
-  bool signatureValid( std::string signature );
+  bool signatureValid( std::string_view signature );
+  std::string signature();    // of the whole message
+  std::shared_ptr<const TypeTree> typeTree();  // cached per distinct signature
   char signatureType();
-  bool hasSignature( std::string signature );
+  bool hasSignature( CStringView signature );
   std::string signatureContents();
 
   void enterContainer( char type, char content );
-  void enterContainer( char type, std::string contents );
+  void enterContainer( char type, CStringView contents );
   void enterContainer();
-  bool enterContainerIf( char type, std::string contents );
-  void skip( std::string types );
+  bool enterContainerIf( char type, CStringView contents );
+  void skip( CStringView types );
   void exitContainer();
+  void rewind();  // back to the first argument
+  bool atEnd();   // end of the current container
 
   std::string sender();
   std::string service();
@@ -44,15 +55,42 @@ public:
   void read( uint64_t &value );
   void read( double &value );
   void read( std::string &value );
+  void read( std::string_view &value );  // valid as long as the reply is alive
   void read( ObjectPath &value );
   void read( std::vector<ObjectPath> &value );
   void read( std::vector<std::string> &value );
   void read( std::vector<std::byte> &value );
 
+  // walks the value at the current position as the tree describes, under a single lock
+  void read( const TypeTree &tree, const TypeVisitor &visitor );
+
+  // structs described with DBUSCPP_STRUCT and arrays of them, unmarshalled under a single lock
+  template <typename T, typename = std::enable_if_t<IsDescribed<T>::value>>
+  void read( T &value ) {
+    std::lock_guard<std::mutex> lock( mutex );
+    detail::Marshal<T>::read( *this, value );
+  }
+
+  template <typename T, typename = std::enable_if_t<IsDescribed<T>::value>>
+  void read( std::vector<T> &value ) {
+    std::lock_guard<std::mutex> lock( mutex );
+    detail::Marshal<std::vector<T>>::read( *this, value );
+  }
+
 private:
+  friend class CallCache;
   friend class Manager;
+  template <typename T>
+  friend struct detail::Marshal;
   void *borrowBusMessage();
 
+  // unlocked primitives for detail::Marshal, the caller holds the mutex
+  void extract( char type, void *value );
+  void enter( char type, const char *contents );
+  void exit();
+  bool end();
+  void walk( const TypeNode &node, const TypeVisitor &visitor );
+
   void *msg = nullptr;
   std::mutex mutex;
 };
@@ -0,0 +1,236 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/reply.h"
+#include "dbuscpp/signature.h"
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+/* Lazy, single-pass ranges over the array or dictionary at the reply's position:
+ *   for ( int32_t v : ArrayRange<int32_t> { reply } ) ...
+ *   for ( auto &entry : DictRange<std::string_view> { reply } )
+ *     if ( entry.key() == "RSSI" )
+ *       rssi = entry.value<int16_t>();
+ * Elements are decoded when dereferenced, the ones left untouched are skipped
+ * with sd_bus_message_skip. The container is entered on construction and left
+ * on destruction, whatever was not iterated is skipped.
+ * An entry's value can be read from the reply once: a second value<T>(), array() or dict()
+ * throws. valueType() keeps working after the value was read.
+ */
+
+namespace dbus {
+
+template <typename T>
+class ArrayRange {
+public:
+  class iterator {
+  public:
+    iterator( ArrayRange *range ) : range( range ) {}
+    T operator*() {
+      return range->current();
+    }
+    iterator &operator++() {
+      range->advance();
+      return *this;
+    }
+    bool operator!=( const iterator & ) const {
+      return !range->done;
+    }
+
+  private:
+    ArrayRange *range;
+  };
+
+  ArrayRange( Reply &reply ) : reply( reply ) {
+    reply.enterContainer( DATA_TYPE::ARRAY, signatureOf<T>() );
+    done = reply.atEnd();
+  }
+  ArrayRange( const ArrayRange &other ) = delete;
+  ArrayRange &operator=( const ArrayRange &rhs ) = delete;
+  ~ArrayRange() {
+    try {
+      while ( !done )
+        advance();
+      reply.exitContainer();
+    } catch ( ... ) {
+    }
+  }
+
+  iterator begin() {
+    return iterator { this };
+  }
+  iterator end() {
+    return iterator { this };
+  }
+
+private:
+  T current() {
+    if ( !value ) {
+      T v {};
+      reply.read( v );
+      value = std::move( v );
+    }
+    return *value;
+  }
+
+  void advance() {
+    if ( !value )
+      reply.skip( signatureOf<T>() );
+    value.reset();
+    done = reply.atEnd();
+  }
+
+  Reply &reply;
+  std::optional<T> value;
+  bool done = false;
+};
+
+template <typename K>
+class DictRange {
+public:
+  class Entry {
+  public:
+    const K &key() const {
+      return m_key;
+    }
+
+    // D-Bus type of the value, the contained type for variants
+    char valueType() {
+      if ( m_signature[0] != DATA_TYPE::VARIANT )
+        return m_signature[0];
+      if ( m_type )
+        return m_type;
+      unread();
+      char type = reply->signatureType();
+      if ( type == DATA_TYPE::VARIANT ) {
+        std::string contents = reply->signatureContents();
+        type = contents.empty() ? static_cast<char>( DATA_TYPE::EMPTY ) : contents[0];
+      }
+      return m_type = type;
+    }
+
+    // value signature as declared by the dictionary, "v" for variants
+    const std::string &valueSignature() const {
+      return m_signature;
+    }
+
+    // reads the value, unwrapping it when the dictionary holds variants
+    template <typename T>
+    T value() {
+      valueType();
+      unread();
+      T v {};
+      if ( m_signature[0] == DATA_TYPE::VARIANT ) {
+        reply->enterContainer( DATA_TYPE::VARIANT, signatureOf<T>() );
+        reply->read( v );
+        reply->exitContainer();
+      } else {
+        reply->read( v );
+      }
+      consumed = true;
+      return v;
+    }
+
+    // nested containers, e.g. the a{sv} of an a{sa{sv}} entry
+    template <typename T>
+    ArrayRange<T> array() {
+      valueType();
+      unread();
+      consumed = true;
+      return ArrayRange<T> { *reply };
+    }
+
+    template <typename K2>
+    DictRange<K2> dict() {
+      valueType();
+      unread();
+      consumed = true;
+      return DictRange<K2> { *reply };
+    }
+
+  private:
+    friend class DictRange;
+
+    // the reply has moved past a value that was read, it cannot be looked at again
+    void unread() const {
+      if ( consumed )
+        throw std::runtime_error( "Dictionary entry value was already read" );
+    }
+
+    Reply *reply = nullptr;
+    K m_key {};
+    std::string m_signature;
+    bool consumed = false;
+    char m_type = 0;  // contained type of a variant value, 0 until looked at
+  };
+
+  class iterator {
+  public:
+    iterator( DictRange *range ) : range( range ) {}
+    Entry &operator*() {
+      return range->entry;
+    }
+    Entry *operator->() {
+      return &range->entry;
+    }
+    iterator &operator++() {
+      range->advance();
+      return *this;
+    }
+    bool operator!=( const iterator & ) const {
+      return !range->done;
+    }
+
+  private:
+    DictRange *range;
+  };
+
+  DictRange( Reply &reply ) : reply( reply ) {
+    reply.enterContainer( DATA_TYPE::ARRAY, reply.signatureContents() );
+    contents = reply.signatureContents();  // e.g. "sv" for a{sv}
+    entry.reply = &reply;
+    entry.m_signature = contents.empty() ? std::string {} : contents.substr( 1 );
+    next();
+  }
+  DictRange( const DictRange &other ) = delete;
+  DictRange &operator=( const DictRange &rhs ) = delete;
+  ~DictRange() {
+    try {
+      while ( !done )
+        advance();
+      reply.exitContainer();
+    } catch ( ... ) {
+    }
+  }
+
+  iterator begin() {
+    return iterator { this };
+  }
+  iterator end() {
+    return iterator { this };
+  }
+
+private:
+  void next() {
+    done = !reply.enterContainerIf( DATA_TYPE::DICT_ENTRY, contents );
+    if ( done )
+      return;
+    reply.read( entry.m_key );
+    entry.consumed = false;
+    entry.m_type = 0;
+  }
+
+  void advance() {
+    if ( !entry.consumed )
+      reply.skip( entry.m_signature );
+    reply.exitContainer();
+    next();
+  }
+
+  Reply &reply;
+  std::string contents;
+  Entry entry;
+  bool done = false;
+};
+
+}  // namespace dbus
@@ -1,9 +1,13 @@
 #pragma once
+#include "dbuscpp/latency.h"
 #include "dbuscpp/reply.h"
 #include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <ostream>
 #include <string>
 
 /* match rule:
@@ -12,29 +16,83 @@
 
 namespace dbus {
 
-using SignalID = boost::uuids::uuid;
+/* Compact subscription handle: slot index in the low 32 bits, generation in the high
+ * 32 bits. Generations come from one process-wide atomic counter, so a handle is never
+ * handed out twice and a stale handle never matches a reused slot.
+ */
+class SignalID {
+public:
+  static constexpr uint32_t NO_INDEX = UINT32_MAX;
+
+  constexpr SignalID() = default;
+  constexpr SignalID( uint32_t index, uint32_t generation )
+    : m_value { ( uint64_t { generation } << 32 ) | index } {}
+
+  // fresh generation, for handles that do not live in a slot table leave the index out
+  static SignalID next( uint32_t index = NO_INDEX );
+
+  constexpr uint32_t index() const {
+    return static_cast<uint32_t>( m_value );
+  }
+  constexpr uint32_t generation() const {
+    return static_cast<uint32_t>( m_value >> 32 );
+  }
+  constexpr uint64_t value() const {
+    return m_value;
+  }
+  constexpr bool valid() const {
+    return generation() != 0;
+  }
+
+  // UUID form for logs and correlation outside the process, built on demand
+  boost::uuids::uuid uuid() const;
+
+  constexpr bool operator==( const SignalID &rhs ) const {
+    return m_value == rhs.m_value;
+  }
+  constexpr bool operator!=( const SignalID &rhs ) const {
+    return m_value != rhs.m_value;
+  }
+  constexpr bool operator<( const SignalID &rhs ) const {
+    return m_value < rhs.m_value;
+  }
+
+private:
+  uint64_t m_value = 0;
+};
+
+std::ostream& operator<<( std::ostream& os, const SignalID& id );
+
+using SignalMessageCallback = std::function<void( SignalID, Reply& )>;
 
 enum SignalStatus { UNDEFINED = 0, ADD_REQUEST, ADDED, MATCH_FAILED, REMOVE_REQUEST, REMOVED };
 
 class Signal {
 public:
   Signal();
+  explicit Signal( SignalID id );
   Signal( std::string rule, std::function<void( SignalID )> callback );
   Signal( const Signal& other );
+  Signal( Signal&& other ) noexcept;
   Signal& operator=( const Signal& rhs );
+  Signal& operator=( Signal&& rhs ) noexcept;
   bool operator==( const Signal& rhs );
   ~Signal();
   std::string rule();
   void updateRule( std::string other );
   SignalID uuid();
   void callback();
+  void callback( Reply& message );
   void registerCallback( std::function<void( SignalID )> cb );
+  void registerMessageCallback( SignalMessageCallback cb );
   void statusCallback();
   void registerStatusCallback( std::function<void( SignalID )> cb );
   void updateStatus( SignalStatus status );
   SignalStatus status();
   void* slot();
   void updateSlot( void* other );
+  // shared with the copies, stays valid after the signal is removed
+  std::shared_ptr<SignalLatency> latency();
 
 private:
   SignalID m_uuid;
@@ -42,8 +100,17 @@ private:
   SignalStatus m_status = SignalStatus::UNDEFINED;
   std::string m_rule;
   std::function<void( SignalID )> m_callback = nullptr;
+  SignalMessageCallback m_messageCallback = nullptr;
   std::function<void( SignalID )> m_statusCallback = nullptr;
+  std::shared_ptr<SignalLatency> m_latency;
 
 };  // class Signal
 
 }  // namespace dbus
+
+template <>
+struct std::hash<dbus::SignalID> {
+  std::size_t operator()( const dbus::SignalID& id ) const noexcept {
+    return std::hash<uint64_t> {}( id.value() );
+  }
+};
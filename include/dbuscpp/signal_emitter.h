@@ -0,0 +1,79 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/connection.h"
+#include "dbuscpp/message.h"
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Signal emission:
+ *   PreparedSignal level( "/com/example/sensor0", "com.example.Sensor", "Level" );
+ *   SignalEmitter emitter;
+ *   emitter.emit( level, 42.0 );  // queued, no flush
+ *   emitter.flush();
+ * A signal is written directly while the outgoing queue is empty, whatever does not
+ * fit stays queued and the next emit, flush or bulk emit waits until it is written.
+ * The outgoing queue obeys the flow control of the connection. Every call takes the bus
+ * lock, so a shared connection can be used by the signal loop and Managers meanwhile.
+ */
+
+namespace dbus {
+
+// signal header validated once, identical names share one copy
+class PreparedSignal {
+public:
+  PreparedSignal( CStringView object, CStringView interface, CStringView member );
+
+  const char *path() const;
+  const char *interface() const;
+  const char *member() const;
+
+private:
+  std::shared_ptr<const std::string> m_object;
+  std::shared_ptr<const std::string> m_interface;
+  std::shared_ptr<const std::string> m_member;
+};
+
+class SignalEmitter {
+public:
+  SignalEmitter( int connectionType = ConnectionType::NEW_SYSTEM_DBUS );
+  SignalEmitter( const SignalEmitter &other ) = delete;
+  SignalEmitter &operator=( const SignalEmitter &rhs ) = delete;
+  ~SignalEmitter();  // flushes
+
+  Connection &connection();
+
+  Message signal( const PreparedSignal &header );
+
+  template <typename... Args>
+  void emit( const PreparedSignal &header, const Args &...args ) {
+    Message m = signal( header );
+    ( m.write( args ), ... );
+    emit( m );
+  }
+
+  void emit( const Message &m );
+  // one lock and one flush for all of them
+  void emit( const std::vector<Message> &messages );
+  void flush();
+
+  // keeps the last depth signals of every object path for late joiners, 0 disables
+  void history( std::size_t depth );
+  std::vector<Message> last( CStringView object );
+  // sends the kept signals of the object again, addressed to one peer only
+  std::size_t replay( CStringView object, CStringView destination );
+
+private:
+  void send( const Message &m );  // mutex and bus lock must be held
+
+  Connection conn;
+  std::mutex mutex;
+  std::size_t depth = 0;
+  std::unordered_map<std::string, std::deque<Message>> kept;
+};
+
+}  // namespace dbus
@@ -1,10 +1,19 @@
 #pragma once
 #include "dbuscpp/common.h"
 #include "dbuscpp/connection.h"
+#include "dbuscpp/reply.h"
 #include "dbuscpp/signal.h"
-#include <boost/uuid/uuid.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace dbus {
@@ -17,6 +26,22 @@ enum GroupStatus {
   STOP_REQUEST = 2,
 };
 
+// trades CPU for signal latency, the defaults leave the loop thread untouched
+struct LoopConfig {
+  std::chrono::microseconds busyPoll { 0 };  // keep spinning on sd_bus_process this long
+                                            // after the last message before blocking in poll
+  int cpu = -1;                             // pin the loop thread to this CPU
+  int priority = 0;                         // SCHED_FIFO priority 1-99, needs CAP_SYS_NICE
+  std::string name;                         // thread name, truncated to 15 characters
+
+  // when the bus is lost, the first attempt to reopen it waits reconnectMin,
+  // each failed one doubles the wait up to reconnectMax
+  std::chrono::milliseconds reconnectMin { 100 };
+  std::chrono::milliseconds reconnectMax { 10000 };
+};
+
+using ReconnectCallback = std::function<void()>;
+
 class SignalGroupImp {
 public:
   static SignalGroupImp& get() {
@@ -26,31 +51,93 @@ public:
   SignalGroupImp( const SignalGroupImp& ) = delete;
   SignalGroupImp& operator=( const SignalGroupImp& ) = delete;
   ~SignalGroupImp();
+  // throws when the loop configuration cannot be applied, the loop is stopped again then
   void start();
+  // applied right away when the loop is running, otherwise when it starts
+  void configure( const LoopConfig &config );
+  // the bus the loop listens on from its next start, the shared system bus by default;
+  // the loop stops when a bus that cannot be reopened goes away
+  void useConnection( const Connection &c );
+  void resetConnection();  // back to the shared system bus from the next start
   SignalID createSignal();
   bool matchRule( SignalID uuid, std::string rule );
   bool signalCallback( SignalID uuid, std::function<void( SignalID )> callback );
   bool signalStatusCallback( SignalID uuid, std::function<void( SignalID )> callback );
+  bool signalMessageCallback( SignalID uuid, SignalMessageCallback callback );
+  std::shared_ptr<SignalLatency> latency( SignalID uuid );
   bool add( SignalID uuid );
   bool contains( SignalID uuid );
   void remove( SignalID uuid );
+  // returns once no signal callback is running, so an object whose callbacks were removed
+  // can be destroyed; from a callback it returns right away
+  void synchronize();
+  // waits until the broker accepted the signal's match: ADDED only means AddMatch is
+  // queued. False when it refused, on timeout, and right away on the loop thread
+  bool installed( SignalID uuid, std::chrono::milliseconds timeout );
   SignalStatus status( SignalID uuid );
   GroupStatus status();
   std::size_t size();
 
+  // run on the loop thread once the matches are sent again after a reconnect,
+  // they must not register or unregister callbacks themselves
+  std::size_t registerReconnect( ReconnectCallback callback );
+  void unregisterReconnect( std::size_t id );  // waits for a running callback
+  uint64_t reconnects();
+
+  // used by the match callbacks: keeps a reference to the sd_bus_message, the loop runs
+  // the signal's callbacks once it has released the bus lock
+  void defer( SignalID uuid, void *message );
+  // used by the AddMatch replies
+  void acknowledge( SignalID uuid, bool ok, bool forget = false );
+
 private:
+  struct Delivery {
+    SignalID uuid;
+    Reply message;
+    std::chrono::steady_clock::time_point received;  // taken off the socket
+  };
+
   SignalGroupImp();
   void eventLoop();
   void stop();
-
-  std::vector<Signal> signals;
-
-  std::mutex mutex;
+  void tune();
+  void install( void *bus );  // mutex and bus lock must be held
+  void deliver( Connection &c );
+  bool reconnect( Connection &c, std::chrono::milliseconds &backoff );
+  Signal* find( SignalID uuid );  // mutex must be held
+
+  // indexed by SignalID::index(), the match callbacks keep pointers to the signals
+  std::vector<std::unique_ptr<Signal>> signals;
+  std::vector<uint32_t> freeSlots;
+  std::size_t count = 0;
+
+  // recursive: status callbacks run with it held and may query the group
+  std::recursive_mutex mutex;
   std::thread loopThread;
 
   bool signalChanged = false;
   bool loopRunning = false;
   bool stopRequest = false;
+
+  LoopConfig loopConfig;
+  std::atomic<int64_t> busyPollUsec { 0 };
+  std::unique_ptr<Connection> loopConnection;
+
+  // signals taken off the bus, by the loop or by a Manager sharing the bus
+  std::mutex deliveryMutex;
+  std::vector<Delivery> deliveries;
+  std::mutex callbackMutex;  // held by the loop while a signal callback runs
+  std::atomic<int> wakeFd { -1 };  // of the loop's bus
+  std::atomic<std::thread::id> loopId { std::thread::id {} };
+
+  std::mutex installMutex;
+  std::condition_variable installChanged;
+  std::unordered_map<SignalID, bool> acknowledged;  // broker's answer to each AddMatch
+
+  std::mutex reconnectMutex;  // held while the callbacks run
+  std::map<std::size_t, ReconnectCallback> reconnectCallbacks;
+  std::size_t nextReconnectId = 0;
+  std::atomic<uint64_t> reconnectCount { 0 };
 };
 
 namespace SignalGroup {
@@ -59,6 +146,18 @@ inline void start() {
   SignalGroupImp::get().start();
 }
 
+inline void configure( const LoopConfig &config ) {
+  SignalGroupImp::get().configure( config );
+}
+
+inline void useConnection( const Connection &c ) {
+  SignalGroupImp::get().useConnection( c );
+}
+
+inline void resetConnection() {
+  SignalGroupImp::get().resetConnection();
+}
+
 inline SignalID createSignal() {
   return SignalGroupImp::get().createSignal();
 }
@@ -75,6 +174,16 @@ inline void signalStatusCallback( SignalID uuid, std::function<void( SignalID )>
   SignalGroupImp::get().signalStatusCallback( uuid, callback );
 }
 
+// the callback receives the signal message itself
+inline bool signalMessageCallback( SignalID uuid, SignalMessageCallback callback ) {
+  return SignalGroupImp::get().signalMessageCallback( uuid, callback );
+}
+
+// queue and callback latency histograms, nullptr for an unknown signal
+inline std::shared_ptr<SignalLatency> latency( SignalID uuid ) {
+  return SignalGroupImp::get().latency( uuid );
+}
+
 inline void add( SignalID uuid ) {
   SignalGroupImp::get().add( uuid );
 }
@@ -87,6 +196,14 @@ inline void remove( SignalID uuid ) {
   SignalGroupImp::get().remove( uuid );
 }
 
+inline void synchronize() {
+  SignalGroupImp::get().synchronize();
+}
+
+inline bool installed( SignalID uuid, std::chrono::milliseconds timeout ) {
+  return SignalGroupImp::get().installed( uuid, timeout );
+}
+
 inline int status( SignalID uuid ) {
   return SignalGroupImp::get().status( uuid );
 }
@@ -99,5 +216,18 @@ inline std::size_t size() {
   return SignalGroupImp::get().size();
 }
 
+// caches drop what they learned from the old bus here
+inline std::size_t registerReconnect( ReconnectCallback callback ) {
+  return SignalGroupImp::get().registerReconnect( callback );
+}
+
+inline void unregisterReconnect( std::size_t id ) {
+  SignalGroupImp::get().unregisterReconnect( id );
+}
+
+inline uint64_t reconnects() {
+  return SignalGroupImp::get().reconnects();
+}
+
 }  // namespace SignalGroup
 }  // namespace dbus
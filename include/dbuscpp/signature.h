@@ -0,0 +1,116 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include "dbuscpp/type_tree.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dbus {
+
+// fixed-size, null-terminated signature usable in constant expressions
+template <std::size_t N>
+struct SignatureString {
+  char data[N + 1] = {};
+
+  constexpr SignatureString() = default;
+  constexpr SignatureString( const char ( &str )[N + 1] ) {
+    for ( std::size_t i = 0; i <= N; ++i )
+      data[i] = str[i];
+  }
+
+  constexpr const char *c_str() const {
+    return data;
+  }
+
+  constexpr std::size_t size() const {
+    return N;
+  }
+
+  constexpr char operator[]( std::size_t i ) const {
+    return data[i];
+  }
+};
+
+template <std::size_t A, std::size_t B>
+constexpr SignatureString<A + B> operator+( const SignatureString<A> &a,
+  const SignatureString<B> &b ) {
+  SignatureString<A + B> s;
+  for ( std::size_t i = 0; i < A; ++i )
+    s.data[i] = a.data[i];
+  for ( std::size_t i = 0; i < B; ++i )
+    s.data[A + i] = b.data[i];
+  return s;
+}
+
+// D-Bus signature of a C++ type: Signature<T>::value.c_str()
+template <typename T, typename = void>
+struct Signature;
+
+template <>
+struct Signature<bool> {
+  static constexpr SignatureString<1> value { "b" };
+};
+template <>
+struct Signature<uint8_t> {
+  static constexpr SignatureString<1> value { "y" };
+};
+template <>
+struct Signature<int16_t> {
+  static constexpr SignatureString<1> value { "n" };
+};
+template <>
+struct Signature<uint16_t> {
+  static constexpr SignatureString<1> value { "q" };
+};
+template <>
+struct Signature<int32_t> {
+  static constexpr SignatureString<1> value { "i" };
+};
+template <>
+struct Signature<uint32_t> {
+  static constexpr SignatureString<1> value { "u" };
+};
+template <>
+struct Signature<int64_t> {
+  static constexpr SignatureString<1> value { "x" };
+};
+template <>
+struct Signature<uint64_t> {
+  static constexpr SignatureString<1> value { "t" };
+};
+template <>
+struct Signature<double> {
+  static constexpr SignatureString<1> value { "d" };
+};
+template <>
+struct Signature<std::string> {
+  static constexpr SignatureString<1> value { "s" };
+};
+template <>
+struct Signature<std::string_view> {
+  static constexpr SignatureString<1> value { "s" };
+};
+template <>
+struct Signature<ObjectPath> {
+  static constexpr SignatureString<1> value { "o" };
+};
+template <typename T>
+struct Signature<std::vector<T>> {
+  static constexpr auto value = SignatureString<1> { "a" } + Signature<T>::value;
+};
+template <typename K, typename V>
+struct Signature<std::map<K, V>> {
+  static constexpr auto value = SignatureString<2> { "a{" } + Signature<K>::value +
+                                Signature<V>::value + SignatureString<1> { "}" };
+};
+
+template <typename T>
+constexpr const char *signatureOf() {
+  static_assert( validSignature( Signature<T>::value.c_str() ), "invalid D-Bus signature" );
+  return Signature<T>::value.c_str();
+}
+
+}  // namespace dbus
@@ -0,0 +1,138 @@
+#pragma once
+#include "dbuscpp/common.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+/* D-Bus signature grammar:
+ *   validSignature( "a{sv}" ) is constexpr, it checks nesting, array element types,
+ *   dict-entry rules (basic key, exactly two types, only inside an array) and the
+ *   length and depth limits of the specification.
+ *   typeTree( "a{sv}i" ) parses a signature once into a shared tree. Up to TYPE_TREES
+ *   signatures are cached, past that the cache starts over; trees already handed out stay
+ *   valid as long as they are held.
+ *   reply.read( *tree, visitor ) decodes a whole message by its tree, see reply.h.
+ */
+
+namespace dbus {
+
+namespace detail {
+constexpr std::size_t signatureEnd = std::string_view::npos;
+
+constexpr bool basicType( char c ) {
+  switch ( c ) {
+    case DATA_TYPE::BYTE:
+    case DATA_TYPE::BOOLEAN:
+    case DATA_TYPE::INT16:
+    case DATA_TYPE::UINT16:
+    case DATA_TYPE::INT32:
+    case DATA_TYPE::UINT32:
+    case DATA_TYPE::INT64:
+    case DATA_TYPE::UINT64:
+    case DATA_TYPE::DOUBLE:
+    case DATA_TYPE::STRING:
+    case DATA_TYPE::OBJECT_PATH:
+    case DATA_TYPE::SIGNATURE:
+    case DATA_TYPE::UNIX_FD:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// position after the complete type starting at pos, signatureEnd when it is invalid
+constexpr std::size_t completeType( std::string_view s, std::size_t pos, int arrays, int structs ) {
+  if ( pos >= s.size() )
+    return signatureEnd;
+
+  char c = s[pos];
+  if ( basicType( c ) || c == DATA_TYPE::VARIANT )
+    return pos + 1;
+
+  if ( c == DATA_TYPE::ARRAY ) {
+    if ( ++arrays > 32 )
+      return signatureEnd;
+    if ( pos + 1 >= s.size() || s[pos + 1] != DATA_TYPE::DICT_ENTRY_BEGIN )
+      return completeType( s, pos + 1, arrays, structs );
+
+    // dict entry: basic key, one complete value type
+    if ( ++structs > 32 || pos + 2 >= s.size() || !basicType( s[pos + 2] ) )
+      return signatureEnd;
+    std::size_t end = completeType( s, pos + 3, arrays, structs );
+    if ( end == signatureEnd || end >= s.size() || s[end] != DATA_TYPE::DICT_ENTRY_END )
+      return signatureEnd;
+    return end + 1;
+  }
+
+  if ( c == DATA_TYPE::STRUCT_BEGIN ) {
+    if ( ++structs > 32 || pos + 1 >= s.size() || s[pos + 1] == DATA_TYPE::STRUCT_END )
+      return signatureEnd;
+    std::size_t end = pos + 1;
+    while ( end < s.size() && s[end] != DATA_TYPE::STRUCT_END ) {
+      end = completeType( s, end, arrays, structs );
+      if ( end == signatureEnd )
+        return signatureEnd;
+    }
+    return end < s.size() ? end + 1 : signatureEnd;
+  }
+
+  return signatureEnd;
+}
+}  // namespace detail
+
+// a sequence of complete types, the empty signature is valid (no arguments)
+constexpr bool validSignature( std::string_view signature ) {
+  if ( signature.size() > 255 )
+    return false;
+  std::size_t pos = 0;
+  while ( pos < signature.size() ) {
+    pos = detail::completeType( signature, pos, 0, 0 );
+    if ( pos == detail::signatureEnd )
+      return false;
+  }
+  return true;
+}
+
+struct TypeNode {
+  char type;              // DATA_TYPE, STRUCT and DICT_ENTRY for structs and dict entries
+  std::string signature;  // complete type, e.g. "a{sv}"
+  std::string contents;   // what enterContainer / openContainer expect, e.g. "{sv}"
+  std::vector<TypeNode> children;
+
+  bool basic() const {
+    return detail::basicType( type );
+  }
+};
+
+struct TypeTree {
+  std::string signature;
+  std::vector<TypeNode> types;  // one node per complete type
+};
+
+// parsed tree of the signature, throws when it is invalid
+constexpr std::size_t TYPE_TREES = 1024;
+std::shared_ptr<const TypeTree> typeTree( std::string_view signature );
+
+// basic value read by the tree: strings, object paths and signatures point into the reply,
+// a unix fd is an int32_t
+using BasicValue = std::variant<bool,
+  uint8_t,
+  int16_t,
+  uint16_t,
+  int32_t,
+  uint32_t,
+  int64_t,
+  uint64_t,
+  double,
+  std::string_view>;
+
+// called with each basic value, and with nullptr when a container is reached:
+// returning false skips the container without decoding it
+using TypeVisitor = std::function<bool( const TypeNode &node, const BasicValue *value )>;
+
+}  // namespace dbus
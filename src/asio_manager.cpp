@@ -0,0 +1,317 @@
+#include "dbuscpp/asio_manager.h"
+#include "internal.h"
+#include <boost/asio/error.hpp>
+#include <chrono>
+#include <deque>
+#include <sys/poll.h>
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+// what the io handlers hold on to: the manager is only reached under the mutex, and not
+// at all once its destructor ran
+struct AsioManager::Shared {
+  std::mutex mutex;
+  AsioManager *manager = nullptr;
+};
+
+struct AsioManager::CallContext {
+  AsioManager *manager = nullptr;
+  sd_bus_slot *slot = nullptr;
+  AsyncHandler handler;
+
+  ~CallContext() {
+    ::sd_bus_slot_unref( slot );
+  }
+
+  // invoked from sd_bus_process by whichever thread processes the bus, the bus lock is held
+  static int callback( sd_bus_message *m, void *userdata, sd_bus_error *error ) {
+    std::ignore = error;
+    CallContext *ctx = static_cast<CallContext *>( userdata );
+    boost::system::error_code ec;
+    if ( ::sd_bus_message_is_method_error( m, nullptr ) ) {
+      int e = ::sd_bus_message_get_errno( m );
+      ec = boost::system::error_code( e > 0 ? e : EIO, boost::system::system_category() );
+    }
+    AsyncHandler handler = std::move( ctx->handler );
+    ctx->manager->calls.erase( ctx->slot );  // sd-bus keeps the slot alive until we return
+    handler( ec, Reply { ::sd_bus_message_ref( m ) } );
+    return 0;
+  }
+};
+
+struct AsioManager::SignalContext {
+  void *slot = nullptr;
+  boost::system::error_code failure;
+  std::deque<Reply> pending;
+  std::deque<AsyncHandler> waiters;
+
+  // invoked from sd_bus_process, the bus lock is held
+  static int callback( sd_bus_message *m, void *userdata, sd_bus_error *error ) {
+    std::ignore = error;
+    SignalContext *ctx = static_cast<SignalContext *>( userdata );
+    Reply reply { ::sd_bus_message_ref( m ) };
+    if ( ctx->waiters.empty() ) {
+      ctx->pending.push_back( reply );
+      return 0;
+    }
+    AsyncHandler handler = ctx->waiters.front();
+    ctx->waiters.pop_front();
+    handler( boost::system::error_code {}, reply );
+    return 0;
+  }
+
+  static int installed( sd_bus_message *m, void *userdata, sd_bus_error *error ) {
+    std::ignore = error;
+    SignalContext *ctx = static_cast<SignalContext *>( userdata );
+    if ( !::sd_bus_message_is_method_error( m, nullptr ) )
+      return 0;
+
+    int e = ::sd_bus_message_get_errno( m );
+    ctx->failure = boost::system::error_code( e > 0 ? e : EIO, boost::system::system_category() );
+    while ( !ctx->waiters.empty() ) {
+      ctx->waiters.front()( ctx->failure, Reply {} );
+      ctx->waiters.pop_front();
+    }
+    return 0;
+  }
+};
+
+AsioManager::AsioManager( boost::asio::io_context &io, int connectionType )
+  : io( io ), conn( connectionType ), descriptor( io ), timer( io ),
+    shared( std::make_shared<Shared>() ) {
+  shared->manager = this;
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+  int fd = ::sd_bus_get_fd( (sd_bus *)conn.borrowBusObject() );
+  THROW_EXCEPTION_IF( fd < 0, "Failed to obtain bus file descriptor", -fd );
+  descriptor.assign( fd );
+  arm();
+}
+
+AsioManager::~AsioManager() {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+  shared->manager = nullptr;  // a wait that completed already finds nothing to process
+
+  boost::system::error_code ec;
+  timer.cancel( ec );
+  descriptor.cancel( ec );
+  descriptor.release();  // the fd belongs to the bus
+
+  // dropping the slots cancels the calls and matches, their handlers are completed here
+  for ( auto &c : calls )
+    c.second->handler( boost::asio::error::operation_aborted, Reply {} );
+  calls.clear();
+  for ( auto &s : subscriptions ) {
+    for ( auto &waiter : s.second->waiters )
+      waiter( boost::asio::error::operation_aborted, Reply {} );
+    ::sd_bus_slot_unref( (sd_bus_slot *)s.second->slot );
+  }
+  subscriptions.clear();
+  for ( auto &waiter : writableWaiters )
+    waiter( boost::asio::error::operation_aborted );
+  writableWaiters.clear();
+}
+
+Connection &AsioManager::connection() {
+  return conn;
+}
+
+Message AsioManager::methodCall( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
+  BusLock busLock( conn );
+
+  sd_bus_message *msg = nullptr;
+
+  int r = ::sd_bus_message_new_method_call( (sd_bus *)conn.borrowBusObject(),
+    (sd_bus_message **)&msg,
+    service.c_str(),
+    object.c_str(),
+    interface.c_str(),
+    member.c_str() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create new method call message", -r );
+
+  return Message { msg };
+}
+
+Message AsioManager::propertySet( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
+  Message m = methodCall( service, object, "org.freedesktop.DBus.Properties", "Set" );
+  m.write( interface.c_str() );
+  m.write( member.c_str() );
+  return m;
+}
+
+SignalID AsioManager::subscribe( CStringView rule ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+
+  SignalID id = SignalID::next();
+  auto ctx = std::make_unique<SignalContext>();
+
+  int r = ::sd_bus_add_match_async( (sd_bus *)conn.borrowBusObject(),
+    (sd_bus_slot **)&ctx->slot,
+    rule.c_str(),
+    SignalContext::callback,
+    SignalContext::installed,
+    ctx.get() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to add match rule", -r );
+
+  subscriptions.emplace( id, std::move( ctx ) );
+  arm();
+  return id;
+}
+
+void AsioManager::unsubscribe( SignalID id ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+
+  auto it = subscriptions.find( id );
+  if ( it == subscriptions.end() )
+    return;
+
+  for ( auto &waiter : it->second->waiters )
+    waiter( boost::asio::error::operation_aborted, Reply {} );
+  ::sd_bus_slot_unref( (sd_bus_slot *)it->second->slot );
+  subscriptions.erase( it );
+}
+
+void AsioManager::startCall( const Message &m, AsyncHandler handler ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+
+  try {
+    conn.admit( m.size() );
+  } catch ( const std::exception & ) {
+    handler( boost::system::error_code( ENOBUFS, boost::system::system_category() ), Reply {} );
+    return;
+  }
+
+  auto ctx = std::make_unique<CallContext>();
+  ctx->manager = this;
+  ctx->handler = handler;
+
+  int r = ::sd_bus_call_async( (sd_bus *)conn.borrowBusObject(),
+    &ctx->slot,
+    (sd_bus_message *)m.borrowBusMessage(),
+    CallContext::callback,
+    ctx.get(),
+    0 );
+
+  if ( r < 0 ) {
+    handler( boost::system::error_code( -r, boost::system::system_category() ), Reply {} );
+    return;
+  }
+
+  conn.sent( m.size() );
+  calls.emplace( ctx->slot, std::move( ctx ) );
+  arm();
+}
+
+void AsioManager::startSignal( SignalID id, AsyncHandler handler ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+
+  auto it = subscriptions.find( id );
+  if ( it == subscriptions.end() ) {
+    handler( boost::asio::error::not_found, Reply {} );
+    return;
+  }
+
+  SignalContext *ctx = it->second.get();
+  if ( ctx->failure ) {
+    handler( ctx->failure, Reply {} );
+  } else if ( !ctx->pending.empty() ) {
+    handler( boost::system::error_code {}, ctx->pending.front() );
+    ctx->pending.pop_front();
+  } else {
+    ctx->waiters.push_back( handler );
+  }
+}
+
+void AsioManager::startWritable( WritableHandler handler ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  BusLock busLock( conn );
+  if ( conn.writable() ) {
+    handler( boost::system::error_code {} );
+    return;
+  }
+  writableWaiters.push_back( handler );
+  arm();
+}
+
+// mutex and bus lock must be held
+void AsioManager::process() {
+  sd_bus *bus = (sd_bus *)conn.borrowBusObject();
+
+  int r = 0;
+  while ( ( r = ::sd_bus_process( bus, nullptr ) ) > 0 )
+    ;  // drain everything that is already available
+
+  if ( !writableWaiters.empty() && conn.writable() ) {
+    for ( auto &waiter : writableWaiters )
+      waiter( boost::system::error_code {} );
+    writableWaiters.clear();
+  }
+  arm();
+}
+
+// runs a completed wait, unless the manager is gone
+void AsioManager::resume( const std::shared_ptr<Shared> &shared, bool AsioManager::*pending ) {
+  std::lock_guard<std::mutex> lock( shared->mutex );
+  AsioManager *manager = shared->manager;
+  if ( !manager )
+    return;
+  BusLock busLock( manager->conn );
+  if ( pending )
+    manager->*pending = false;
+  else
+    manager->deadline = UINT64_MAX;
+  manager->process();
+}
+
+// re-arms the descriptor and the timer for whatever the bus waits on,
+// mutex and bus lock must be held
+void AsioManager::arm() {
+  sd_bus *bus = (sd_bus *)conn.borrowBusObject();
+
+  int events = ::sd_bus_get_events( bus );
+  if ( events < 0 )
+    return;  // connection is closed
+
+  if ( ( events & POLLIN ) && !readPending ) {
+    readPending = true;
+    descriptor.async_wait( boost::asio::posix::stream_descriptor::wait_read,
+      [s = shared]( boost::system::error_code ec ) {
+        if ( ec != boost::asio::error::operation_aborted )
+          resume( s, &AsioManager::readPending );
+      } );
+  }
+
+  if ( ( events & POLLOUT ) && !writePending ) {
+    writePending = true;
+    descriptor.async_wait( boost::asio::posix::stream_descriptor::wait_write,
+      [s = shared]( boost::system::error_code ec ) {
+        if ( ec != boost::asio::error::operation_aborted )
+          resume( s, &AsioManager::writePending );
+      } );
+  }
+
+  // absolute CLOCK_MONOTONIC time, which is what steady_clock uses on linux
+  uint64_t usec = UINT64_MAX;
+  ::sd_bus_get_timeout( bus, &usec );
+  if ( usec != UINT64_MAX && usec != deadline ) {
+    deadline = usec;
+    timer.expires_at(
+      std::chrono::steady_clock::time_point { std::chrono::microseconds { usec } } );
+    timer.async_wait( [s = shared]( boost::system::error_code ec ) {
+      if ( ec != boost::asio::error::operation_aborted )
+        resume( s, nullptr );
+    } );
+  }
+}
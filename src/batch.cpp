@@ -0,0 +1,151 @@
+#include "dbuscpp/batch.h"
+#include "dbuscpp/manager.h"
+#include "internal.h"
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+namespace {
+template <typename T>
+void writeVariantValue( Message &m, char type, const T &value ) {
+  m.openContainer( DATA_TYPE::VARIANT, type );
+  m.write( value );
+  m.closeContainer();
+}
+
+template <typename T>
+void readVariantValue( Reply &reply, char type, PropertyValue &value ) {
+  T v {};
+  reply.enterContainer( DATA_TYPE::VARIANT, type );
+  reply.read( v );
+  reply.exitContainer();
+  value = std::move( v );
+}
+}  // namespace
+
+namespace dbus {
+
+void writeVariant( Message &m, const PropertyValue &value ) {
+  switch ( value.index() ) {
+    case 1:
+      writeVariantValue( m, DATA_TYPE::BOOLEAN, std::get<bool>( value ) );
+      break;
+    case 2:
+      writeVariantValue( m, DATA_TYPE::BYTE, std::get<uint8_t>( value ) );
+      break;
+    case 3:
+      writeVariantValue( m, DATA_TYPE::INT16, std::get<int16_t>( value ) );
+      break;
+    case 4:
+      writeVariantValue( m, DATA_TYPE::UINT16, std::get<uint16_t>( value ) );
+      break;
+    case 5:
+      writeVariantValue( m, DATA_TYPE::INT32, std::get<int32_t>( value ) );
+      break;
+    case 6:
+      writeVariantValue( m, DATA_TYPE::UINT32, std::get<uint32_t>( value ) );
+      break;
+    case 7:
+      writeVariantValue( m, DATA_TYPE::INT64, std::get<int64_t>( value ) );
+      break;
+    case 8:
+      writeVariantValue( m, DATA_TYPE::UINT64, std::get<uint64_t>( value ) );
+      break;
+    case 9:
+      writeVariantValue( m, DATA_TYPE::DOUBLE, std::get<double>( value ) );
+      break;
+    case 10:
+      writeVariantValue( m, DATA_TYPE::STRING, std::get<std::string>( value ) );
+      break;
+    case 11:
+      writeVariantValue( m, DATA_TYPE::OBJECT_PATH, std::get<ObjectPath>( value ) );
+      break;
+    default:
+      THROW_EXCEPTION_IF( true, "Failed to write variant, no value", -EINVAL );
+  }
+}
+
+bool readVariant( Reply &reply, PropertyValue &value ) {
+  if ( reply.signatureType() != DATA_TYPE::VARIANT )
+    return false;
+
+  std::string contents = reply.signatureContents();
+  if ( contents.size() != 1 )
+    return false;
+
+  switch ( contents[0] ) {
+    case DATA_TYPE::BOOLEAN:
+      readVariantValue<bool>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::BYTE:
+      readVariantValue<uint8_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::INT16:
+      readVariantValue<int16_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::UINT16:
+      readVariantValue<uint16_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::INT32:
+      readVariantValue<int32_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::UINT32:
+      readVariantValue<uint32_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::INT64:
+      readVariantValue<int64_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::UINT64:
+      readVariantValue<uint64_t>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::DOUBLE:
+      readVariantValue<double>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::STRING:
+      readVariantValue<std::string>( reply, contents[0], value );
+      return true;
+    case DATA_TYPE::OBJECT_PATH:
+      readVariantValue<ObjectPath>( reply, contents[0], value );
+      return true;
+    default:
+      return false;
+  }
+}
+
+SendBatch::SendBatch( Manager &manager ) : manager( manager ), lock( manager.conn ) {}
+
+SendBatch::~SendBatch() {
+  try {
+    if ( count )
+      manager.flush();
+  } catch ( ... ) {
+  }
+}
+
+void SendBatch::send( const Message &m ) {
+  manager.enqueue( m );
+  ++count;
+}
+
+void SendBatch::propertySet( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
+  const PropertyValue &value ) {
+  Message m =
+    manager.newMethodCall( service, object, "org.freedesktop.DBus.Properties", "Set" );
+  m.write( interface.c_str() );
+  m.write( member.c_str() );
+  writeVariant( m, value );
+  send( m );
+}
+
+void SendBatch::flush() {
+  manager.flush();
+}
+
+std::size_t SendBatch::size() const {
+  return count;
+}
+
+}  // namespace dbus
@@ -0,0 +1,40 @@
+#pragma once
+#include "dbuscpp/connection.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <systemd/sd-bus.h>
+
+namespace dbus {
+
+// the steps of sd_bus_open_system, with the options that must be set before the start
+// system: the settings sd_bus_open_system gives the system bus
+int openBus( sd_bus **bus, const char *address, int options, bool system = false );
+int openSystemBus( sd_bus **bus, int options );
+
+// what all copies of a Connection share
+struct BusState {
+  BusState() = default;
+  BusState( const BusState &other ) = delete;
+  BusState &operator=( const BusState &rhs ) = delete;
+  ~BusState();
+
+  sd_bus *bus = nullptr;
+  std::function<int( sd_bus ** )> connect;  // opens the bus, unset for the thread default
+  std::recursive_mutex mutex;
+  int wakeFd = -1;  // eventfd written when a user leaves messages for the event loop
+
+  FlowControl flow;
+  std::deque<std::size_t> sizes;  // of the messages still in the write queue, oldest first
+  std::size_t bytes = 0;
+  uint64_t blocked = 0;
+  uint64_t rejected = 0;
+
+  std::shared_ptr<Recorder> recorder;
+  sd_bus_slot *recordFilter = nullptr;  // sees every incoming message first
+};
+
+}  // namespace dbus
@@ -0,0 +1,309 @@
+#include "dbuscpp/call_cache.h"
+#include "dbuscpp/signal_group.h"
+#include "internal.h"
+#include <cstring>
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+namespace {
+// calls with more argument data than this are not cached
+const std::size_t KEY_ARGUMENTS = 4096;
+
+bool fixedType( char type ) {
+  return std::strchr( "ybnqiuxtdh", type ) != nullptr;
+}
+
+// type, length and bytes of every value from the read position on, containers bracketed,
+// so different arguments never give the same key; 0 once the key outgrows KEY_ARGUMENTS
+int appendArguments( sd_bus_message *m, std::string &key ) {
+  char type;
+  const char *contents;
+  int r;
+  while ( ( r = ::sd_bus_message_peek_type( m, &type, &contents ) ) > 0 ) {
+    key.push_back( type );
+    if ( contents ) {
+      key.append( contents ).push_back( '\0' );
+      // arrays of fixed types but unix fds come in one piece
+      if ( type == SD_BUS_TYPE_ARRAY && !contents[1] && fixedType( contents[0] ) &&
+           contents[0] != SD_BUS_TYPE_UNIX_FD ) {
+        const void *data = nullptr;
+        std::size_t size = 0;
+        if ( ( r = ::sd_bus_message_read_array( m, contents[0], &data, &size ) ) < 0 )
+          return r;
+        if ( key.size() + sizeof( size ) + size > KEY_ARGUMENTS )
+          return 0;
+        key.append( reinterpret_cast<const char *>( &size ), sizeof( size ) );
+        key.append( static_cast<const char *>( data ), size );
+        continue;
+      }
+      if ( ( r = ::sd_bus_message_enter_container( m, type, contents ) ) <= 0 )
+        return r < 0 ? r : -EBADMSG;
+      if ( ( r = appendArguments( m, key ) ) <= 0 )
+        return r;
+      if ( ( r = ::sd_bus_message_exit_container( m ) ) < 0 )
+        return r;
+      key.push_back( '\0' );
+    } else if ( fixedType( type ) ) {
+      uint64_t value = 0;
+      if ( ( r = ::sd_bus_message_read_basic( m, type, &value ) ) < 0 )
+        return r;
+      key.append( reinterpret_cast<const char *>( &value ), sizeof( value ) );
+    } else {  // string, object path, signature
+      const char *value = nullptr;
+      if ( ( r = ::sd_bus_message_read_basic( m, type, &value ) ) < 0 )
+        return r;
+      std::size_t size = std::strlen( value );
+      key.append( reinterpret_cast<const char *>( &size ), sizeof( size ) );
+      key.append( value, size );
+    }
+    if ( key.size() > KEY_ARGUMENTS )
+      return 0;
+  }
+  return r < 0 ? r : 1;
+}
+}  // namespace
+
+CallCache::CallCache( Manager &manager ) : manager( manager ) {
+  reconnectCallback = SignalGroup::registerReconnect( [this]() { invalidate(); } );
+}
+
+CallCache::~CallCache() {
+  SignalGroup::unregisterReconnect( reconnectCallback );  // before the lock, it may wait
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    for ( auto &id : signals )
+      SignalGroup::remove( id );
+    if ( owners )
+      owners->unregisterOwnerChanged( ownersCallback );
+  }
+  // both kinds of callbacks run on the signal loop and may be running right now
+  SignalGroup::synchronize();
+}
+
+void CallCache::ttl( CStringView interface, CStringView member, std::chrono::milliseconds ttl ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  ttls[{ interface.c_str(), member.c_str() }] = ttl;
+}
+
+void CallCache::invalidateOn( CStringView rule, CStringView service ) {
+  std::string name { service.c_str() };
+  SignalID id = SignalGroup::createSignal();
+  SignalGroup::matchRule( id, rule.c_str() );
+  SignalGroup::signalCallback( id, [this, name]( SignalID ) {
+    if ( name.empty() )
+      invalidate();
+    else
+      invalidate( name );
+  } );
+  SignalGroup::add( id );
+  SignalGroup::start();
+
+  std::lock_guard<std::mutex> lock( mutex );
+  signals.push_back( id );
+}
+
+void CallCache::invalidateOn( NameOwnerCache &owners ) {
+  std::size_t id = owners.registerOwnerChanged(
+    [this]( const std::string &name, const std::string &, const std::string & ) {
+      invalidate( name );
+    } );
+
+  std::lock_guard<std::mutex> lock( mutex );
+  if ( this->owners )
+    this->owners->unregisterOwnerChanged( ownersCallback );
+  this->owners = &owners;
+  ownersCallback = id;
+}
+
+Reply CallCache::call( Message m ) {
+  std::chrono::milliseconds ttl;
+  NameOwnerCache *watch = nullptr;
+
+  std::promise<Reply> promise;
+  std::shared_future<Reply> result;
+  bool leader = false;
+  bool cached = false;
+  uint64_t started = 0;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    auto t = ttls.find( { m.interface(), m.member() } );
+    if ( ( cached = t != ttls.end() ) )
+      ttl = t->second;
+  }
+  // never call with the mutex held, invalidation callbacks need it while the bus is busy
+  if ( !cached )
+    return manager.call( m );
+
+  Key key { m.service(), m.path(), m.interface(), m.member(), std::string {} };
+  cached = arguments( m, std::get<4>( key ) );
+  m = outgoing( m );
+  if ( !cached )
+    return manager.call( m );
+
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    auto it = entries.find( key );
+    if ( it != entries.end() ) {
+      if ( std::chrono::steady_clock::now() < it->second.expires )
+        return copy( it->second.reply );
+      entries.erase( it );
+    }
+
+    auto f = inflight.find( key );
+    if ( f != inflight.end() ) {
+      result = f->second.reply;
+    } else {
+      result = promise.get_future().share();
+      inflight.emplace( key, Flight { result, generation } );
+      leader = true;
+    }
+    started = generation;
+
+    // unique names never change owner
+    if ( owners && !std::get<0>( key ).empty() && std::get<0>( key )[0] != ':' )
+      watch = owners;
+  }
+
+  if ( !leader ) {
+    Reply reply = result.get();  // rethrows the leader's failure
+    std::lock_guard<std::mutex> lock( mutex );
+    return copy( reply );
+  }
+
+  if ( watch )
+    watch->resolve( std::get<0>( key ) );  // makes sure owner changes are reported
+
+  try {
+    Reply reply = manager.call( m );
+    Reply shared;
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      shared = copy( reply );  // the leader goes on reading its own
+      auto now = std::chrono::steady_clock::now();
+      if ( generation == started ) {  // not invalidated while in flight
+        purge( now );
+        entries[key] = Entry { shared, now + ttl };
+      }
+      auto f = inflight.find( key );
+      if ( f != inflight.end() && f->second.generation == started )
+        inflight.erase( f );
+    }
+    promise.set_value( shared );
+    return reply;
+  } catch ( ... ) {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      auto f = inflight.find( key );
+      if ( f != inflight.end() && f->second.generation == started )
+        inflight.erase( f );
+    }
+    promise.set_exception( std::current_exception() );
+    throw;
+  }
+}
+
+// calls in flight are left to finish, but their replies are not kept nor shared with
+// later callers
+void CallCache::invalidate() {
+  std::lock_guard<std::mutex> lock( mutex );
+  ++generation;
+  entries.clear();
+  inflight.clear();
+}
+
+void CallCache::invalidate( CStringView service ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  std::string name { service.c_str() };
+  ++generation;
+  for ( auto it = entries.begin(); it != entries.end(); ) {
+    if ( std::get<0>( it->first ) == name )
+      it = entries.erase( it );
+    else
+      ++it;
+  }
+  for ( auto it = inflight.begin(); it != inflight.end(); ) {
+    if ( std::get<0>( it->first ) == name )
+      it = inflight.erase( it );
+    else
+      ++it;
+  }
+}
+
+std::size_t CallCache::size() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return entries.size();
+}
+
+// every caller decodes a message of its own, with its own read position
+Reply CallCache::copy( Reply &reply ) {
+  sd_bus_message *source = (sd_bus_message *)reply.borrowBusMessage();
+  // messages reference the bus, whose reference count is not atomic
+  BusLock busLock { manager.connection() };
+
+  sd_bus_message *m = nullptr;
+  int r = ::sd_bus_message_new(
+    ::sd_bus_message_get_bus( source ), &m, SD_BUS_MESSAGE_METHOD_RETURN );
+  THROW_EXCEPTION_IF( r < 0, "Failed to copy cached reply", -r );
+  Reply result { m };
+
+  uint64_t cookie = 1;  // sealing wants one, nothing is sent
+  ::sd_bus_message_get_cookie( source, &cookie );
+  const char *sender = ::sd_bus_message_get_sender( source );
+  if ( sender )
+    r = ::sd_bus_message_set_sender( m, sender );
+  if ( r >= 0 && ( r = ::sd_bus_message_rewind( source, 1 ) ) >= 0 &&
+       ( r = ::sd_bus_message_copy( m, source, 1 ) ) >= 0 &&
+       ( r = ::sd_bus_message_seal( m, cookie, 0 ) ) >= 0 )
+    r = ::sd_bus_message_rewind( m, 1 );
+  ::sd_bus_message_rewind( source, 1 );
+  THROW_EXCEPTION_IF( r < 0, "Failed to copy cached reply", -r );
+  return result;
+}
+
+// a body can only be read back once it is sealed: m gets a cookie of its own and is never
+// sent, outgoing() copies it into the call that goes on the wire
+bool CallCache::arguments( Message &m, std::string &key ) {
+  std::lock_guard<std::mutex> lock( m.mutex );
+  sd_bus_message *msg = (sd_bus_message *)m.borrowBusMessage();
+
+  int r = ::sd_bus_message_seal( msg, 1, 0 );
+  if ( r == -EPERM )
+    r = 0;  // sealed already
+  if ( r >= 0 && ( r = ::sd_bus_message_rewind( msg, 1 ) ) >= 0 )
+    r = appendArguments( msg, key );
+  THROW_EXCEPTION_IF( r < 0, "Failed to read call arguments", -r );
+  return r > 0;
+}
+
+Message CallCache::outgoing( Message &m ) {
+  sd_bus_message *source = (sd_bus_message *)m.borrowBusMessage();
+  Message copy = manager.methodCall( ::sd_bus_message_get_destination( source ),
+    ::sd_bus_message_get_path( source ),
+    ::sd_bus_message_get_interface( source ),
+    ::sd_bus_message_get_member( source ) );
+  sd_bus_message *msg = (sd_bus_message *)copy.borrowBusMessage();
+
+  int r = ::sd_bus_message_set_auto_start( msg, ::sd_bus_message_get_auto_start( source ) );
+  if ( r >= 0 )
+    r = ::sd_bus_message_set_allow_interactive_authorization(
+      msg, ::sd_bus_message_get_allow_interactive_authorization( source ) );
+  if ( r >= 0 && ( r = ::sd_bus_message_rewind( source, 1 ) ) >= 0 )
+    r = ::sd_bus_message_copy( msg, source, 1 );
+  THROW_EXCEPTION_IF( r < 0, "Failed to copy call", -r );
+  copy.m_size = m.m_size;
+  return copy;
+}
+
+// drops the expired replies, at most once a second
+void CallCache::purge( std::chrono::steady_clock::time_point now ) {
+  if ( now - purged < std::chrono::seconds { 1 } )
+    return;
+  purged = now;
+  for ( auto it = entries.begin(); it != entries.end(); ) {
+    if ( it->second.expires <= now )
+      it = entries.erase( it );
+    else
+      ++it;
+  }
+}
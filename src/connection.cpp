@@ -1,73 +1,317 @@
 
 #include "dbuscpp/connection.h"
+#include "dbuscpp/connection_registry.h"
+#include "dbuscpp/recorder.h"
+#include "bus_state.h"
 #include "internal.h"
+#include <cerrno>
+#include <cstdlib>
 #include <string>
+#include <sys/eventfd.h>
 #include <systemd/sd-bus.h>
+#include <unistd.h>
+#include <utility>
 
 using namespace dbus;
 
-Connection::Connection( int connectionType ) {
+namespace {
+int record_filter( sd_bus_message *m, void *userdata, sd_bus_error *error ) {
+  std::ignore = error;
+  static_cast<Recorder *>( userdata )->record( m, RecordDirection::RECORD_RECEIVED );
+  return 0;  // let the message through
+}
+
+// state mutex must be held
+int installRecorder( BusState &state ) {
+  state.recordFilter = ::sd_bus_slot_unref( state.recordFilter );
+  if ( !state.recorder || !state.bus )
+    return 0;
+  return ::sd_bus_add_filter(
+    state.bus, &state.recordFilter, record_filter, state.recorder.get() );
+}
+}  // namespace
+
+namespace dbus {
+// sd_bus_open_system with the options applied before the start; what sd-bus does not let
+// us set is the system flag, so sd_bus_get_scope does not report "system"
+int openSystemBus( sd_bus **bus, int options ) {
+  if ( !options )
+    return ::sd_bus_open_system( bus );
+
+  const char *address = std::getenv( "DBUS_SYSTEM_BUS_ADDRESS" );
+  return openBus( bus, address ? address : "unix:path=/run/dbus/system_bus_socket", options, true );
+}
+
+int openBus( sd_bus **bus, const char *address, int options, bool system ) {
+  int r = ::sd_bus_new( bus );
+  if ( r < 0 )
+    return r;
+
+  // as on sd_bus_open_system: methods check their callers, who need these credentials
+  const uint64_t systemCreds =
+    SD_BUS_CREDS_UID | SD_BUS_CREDS_EUID | SD_BUS_CREDS_EFFECTIVE_CAPS;
+  if ( system && ( ( r = ::sd_bus_set_trusted( *bus, 0 ) ) < 0 ||
+                   ( r = ::sd_bus_negotiate_creds( *bus, 1, systemCreds ) ) < 0 ) ) {
+    *bus = ::sd_bus_unref( *bus );
+    return r;
+  }
+
+  if ( ( r = ::sd_bus_set_address( *bus, address ) ) < 0 ||
+       ( r = ::sd_bus_set_bus_client( *bus, 1 ) ) < 0 ||
+       ( r = ::sd_bus_set_monitor( *bus, options & ConnectionOption::MONITOR ) ) < 0 ||
+       ( r = ::sd_bus_start( *bus ) ) < 0 )
+    *bus = ::sd_bus_unref( *bus );
+  return r;
+}
+
+BusState::~BusState() {
+  recordFilter = ::sd_bus_slot_unref( recordFilter );
+  bus = ::sd_bus_flush_close_unref( bus );
+  if ( wakeFd >= 0 )
+    ::close( wakeFd );
+}
+}  // namespace dbus
+
+Connection::Connection( int connectionType, int options ) {
+  THROW_EXCEPTION_IF( options && connectionType != ConnectionType::NEW_SYSTEM_DBUS,
+    "Connection options require a new connection" );
+  if ( connectionType == ConnectionType::SHARED_SYSTEM_DBUS ) {
+    state = ConnectionRegistry::system().state;
+    return;
+  }
+
   int r = 0;
-  if ( connectionType == ConnectionType::REUSE_SYSTEM_DBUS )
-    r = ::sd_bus_default_system( (sd_bus **)&bus );
-  else if ( connectionType == ConnectionType::NEW_SYSTEM_DBUS )
-    r = ::sd_bus_open_system( (sd_bus **)&bus );
-  else
+  state = std::make_shared<BusState>();
+  if ( connectionType == ConnectionType::REUSE_SYSTEM_DBUS ) {
+    r = ::sd_bus_default_system( &state->bus );
+  } else if ( connectionType == ConnectionType::NEW_SYSTEM_DBUS ) {
+    state->connect = [options]( sd_bus **bus ) { return openSystemBus( bus, options ); };
+    r = state->connect( &state->bus );
+  } else {
     THROW_EXCEPTION_IF( true, "Unknown connectionType (" + std::to_string( connectionType ) + ")" );
+  }
   THROW_EXCEPTION_IF( r < 0, "Failed to create system bus connection", -r );
 }
 
-Connection::Connection( const Connection &other ) {
-  std::lock_guard<std::mutex> lock( mutex );
-  if ( bus )
-    bus = ::sd_bus_unref( (sd_bus *)bus );
-  bus = ::sd_bus_ref( (sd_bus *)other.bus );
+Connection::Connection( CStringView address, int options ) : state( std::make_shared<BusState>() ) {
+  std::string target { address.c_str() };
+  state->connect = [target, options]( sd_bus **bus ) {
+    return openBus( bus, target.c_str(), options );
+  };
+  int r = state->connect( &state->bus );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create bus connection", -r );
 }
 
-Connection::~Connection() {
-  bus = ::sd_bus_flush_close_unref( (sd_bus *)bus );
+Connection Connection::adopt( void *bus ) {
+  THROW_EXCEPTION_IF( !bus, "Failed to adopt bus, it is null" );
+  auto state = std::make_shared<BusState>();
+  state->bus = (sd_bus *)bus;
+  // shared with an event loop like the system bus, see BusLock
+  state->wakeFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  THROW_EXCEPTION_IF( state->wakeFd < 0, "Failed to create wake-up event", errno );
+  return Connection { std::move( state ) };
 }
 
-Connection &Connection::operator=( const Connection &rhs ) {
-  if ( this == &rhs )
-    return *this;
+Connection::Connection( std::shared_ptr<BusState> state ) : state( std::move( state ) ) {}
 
-  std::lock_guard<std::mutex> lock( mutex );
-  bus = ::sd_bus_flush_close_unref( (sd_bus *)bus );
-  bus = ::sd_bus_ref( (sd_bus *)rhs.bus );
-  return *this;
-}
+Connection::Connection( const Connection &other ) = default;
+
+Connection::Connection( Connection &&other ) noexcept = default;
+
+Connection::~Connection() = default;
+
+Connection &Connection::operator=( const Connection &rhs ) = default;
+
+Connection &Connection::operator=( Connection &&rhs ) noexcept = default;
 
 std::string Connection::address() {
   if ( !ready() )
     return std::string {};
 
   const char *address;
-  int r = ::sd_bus_get_address( (sd_bus *)bus, &address );
+  int r = ::sd_bus_get_address( state->bus, &address );
 
   THROW_EXCEPTION_IF( r < 0, "Failed to obtain bus address", -r );
 
   return std::string { address };
 }
 
+// a shared bus that was not used yet is neither open nor ready
 bool Connection::open() {
-  int r = ::sd_bus_is_open( (sd_bus *)bus );
+  int r = ::sd_bus_is_open( state ? state->bus : nullptr );
   return r >= 0;
 }
 
 bool Connection::ready() {
-  int r = ::sd_bus_is_ready( (sd_bus *)bus );
+  int r = ::sd_bus_is_ready( state ? state->bus : nullptr );
   return r >= 0;
 }
 
 std::chrono::microseconds Connection::timeout() {
   uint64_t usec;
-  int r = ::sd_bus_get_timeout( (sd_bus *)bus, &usec );
+  int r = ::sd_bus_get_timeout( (sd_bus *)borrowBusObject(), &usec );
   THROW_EXCEPTION_IF( r < 0, "Failed to read bus timeout", -r );
   return std::chrono::microseconds { usec };
 }
 
+void Connection::flowControl( const FlowControl &limits ) {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  state->flow = limits;
+}
+
+FlowStats Connection::flowStats() {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  FlowStats stats;
+  stats.queuedMessages = drained();
+  stats.queuedBytes = state->bytes;
+  stats.blocked = state->blocked;
+  stats.rejected = state->rejected;
+  return stats;
+}
+
+std::size_t Connection::queuedMessages() {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  return drained();
+}
+
+std::size_t Connection::queuedBytes() {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  drained();
+  return state->bytes;
+}
+
+bool Connection::writable() {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  std::size_t n = drained();
+  const FlowControl &flow = state->flow;
+  return ( !flow.highMessages || n <= flow.lowMessages ) &&
+         ( !flow.highBytes || state->bytes <= flow.lowBytes );
+}
+
+void Connection::admit( std::size_t size ) {
+  BusLock lock( *this );
+  std::size_t n = drained();
+  const FlowControl &flow = state->flow;
+  if ( ( !flow.highMessages || n + 1 <= flow.highMessages ) &&
+       ( !flow.highBytes || state->bytes + size <= flow.highBytes ) )
+    return;
+
+  if ( flow.policy == FlowPolicy::FLOW_FAIL ) {
+    ++state->rejected;
+    THROW_EXCEPTION_IF( true,
+      "Outgoing queue is full (" + std::to_string( n ) + " messages, " +
+        std::to_string( state->bytes ) + " bytes)" );
+  }
+
+  // write what the socket takes until the queue is down to the low watermarks, not all
+  // of it; sd_bus_process also dispatches what arrives meanwhile, as callBatch does
+  ++state->blocked;
+  while ( !writable() ) {
+    int r = ::sd_bus_process( state->bus, nullptr );
+    THROW_EXCEPTION_IF( r < 0, "Failed to drain outgoing queue", -r );
+    if ( r > 0 )
+      continue;
+    r = ::sd_bus_wait( state->bus, UINT64_MAX );
+    THROW_EXCEPTION_IF( r < 0, "Failed to wait for the outgoing queue", -r );
+  }
+}
+
+void Connection::sent( std::size_t size ) {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  // the message just sent is the last one in the queue, if sd-bus did not write it already
+  std::size_t n = drained( 1 );
+  if ( n > state->sizes.size() ) {
+    state->sizes.push_back( size );
+    state->bytes += size;
+  }
+}
+
+// syncs the tracked sizes with the sd-bus write queue, mutex must be held. Messages sd-bus
+// queued on its own (AddMatch, replies of its object vtables, ...) are counted without
+// bytes; the last `untracked` ones in the queue are left for the caller to account for.
+std::size_t Connection::drained( std::size_t untracked ) {
+  uint64_t n = 0;
+  int r = ::sd_bus_get_n_queued_write( (sd_bus *)borrowBusObject(), &n );
+  THROW_EXCEPTION_IF( r < 0, "Failed to read outgoing queue length", -r );
+
+  std::size_t tracked = n > untracked ? static_cast<std::size_t>( n ) - untracked : 0;
+  // the queue is written in order, whatever is beyond its length is gone
+  while ( state->sizes.size() > tracked ) {
+    state->bytes -= state->sizes.front();
+    state->sizes.pop_front();
+  }
+  while ( state->sizes.size() < tracked )
+    state->sizes.push_back( 0 );
+  return static_cast<std::size_t>( n );
+}
+
+bool Connection::reopenable() {
+  return state && state->connect;
+}
+
+void Connection::reconnect() {
+  THROW_EXCEPTION_IF( !state, "Failed to reconnect, connection was moved from" );
+  THROW_EXCEPTION_IF(
+    !state->connect, "Failed to reconnect, the bus has no address to reopen" );
+
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  // whatever was still queued went down with the old bus
+  state->bus = ::sd_bus_close_unref( state->bus );
+  state->sizes.clear();
+  state->bytes = 0;
+
+  int r = state->connect( &state->bus );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create system bus connection", -r );
+  r = installRecorder( *state );
+  THROW_EXCEPTION_IF( r < 0, "Failed to install the recorder", -r );
+}
+
+void Connection::record( std::shared_ptr<Recorder> recorder ) {
+  borrowBusObject();
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  state->recorder = std::move( recorder );
+  int r = installRecorder( *state );
+  THROW_EXCEPTION_IF( r < 0, "Failed to install the recorder", -r );
+}
+
+bool Connection::tracing() noexcept {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  return state->recorder != nullptr;
+}
+
+void Connection::trace( void *message, int direction, uint64_t timestamp ) noexcept {
+  std::lock_guard<std::recursive_mutex> lock( state->mutex );
+  if ( state->recorder )
+    state->recorder->record( message, direction, timestamp );
+}
+
+int Connection::wakeDescriptor() {
+  return state ? state->wakeFd : -1;
+}
+
 void *Connection::borrowBusObject() {
+  THROW_EXCEPTION_IF( !state, "Failed to borrow bus object, connection was moved from" );
+  if ( state->connect ) {
+    // sd_bus_start only begins the handshake, the first message is queued behind Hello
+    std::lock_guard<std::recursive_mutex> lock( state->mutex );
+    if ( !state->bus ) {
+      int r = state->connect( &state->bus );
+      THROW_EXCEPTION_IF( r < 0, "Failed to create system bus connection", -r );
+    }
+  }
   THROW_EXCEPTION_IF( !ready(), "Failed to borrow bus object, connection is not established" );
-  return bus;
+  return state->bus;
+}
+
+BusLock::BusLock( Connection &c, bool wake ) : state( c.state ), wake( wake ) {
+  THROW_EXCEPTION_IF( !state, "Failed to lock bus, connection was moved from" );
+  state->mutex.lock();
+}
+
+BusLock::~BusLock() {
+  // sd_bus_call and sd_bus_wait read whatever arrives, signals included
+  uint64_t n = 0;
+  if ( wake && state->wakeFd >= 0 && ::sd_bus_get_n_queued_read( state->bus, &n ) >= 0 && n > 0 )
+    ::eventfd_write( state->wakeFd, 1 );
+  state->mutex.unlock();
 }
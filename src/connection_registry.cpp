@@ -0,0 +1,50 @@
+#include "dbuscpp/connection_registry.h"
+#include "bus_state.h"
+#include "internal.h"
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <sys/eventfd.h>
+
+using namespace dbus;
+
+namespace {
+struct Registry {
+  std::mutex mutex;
+  std::shared_ptr<BusState> shared;
+};
+
+Registry &registry() {
+  static Registry r;
+  return r;
+}
+}  // namespace
+
+Connection ConnectionRegistry::system() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock( r.mutex );
+  if ( !r.shared ) {
+    auto state = std::make_shared<BusState>();
+    state->wakeFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    THROW_EXCEPTION_IF( state->wakeFd < 0, "Failed to create wake-up event", errno );
+    state->connect = []( sd_bus **bus ) { return ::sd_bus_open_system( bus ); };
+    r.shared = std::move( state );
+  }
+  return Connection { r.shared };
+}
+
+void ConnectionRegistry::preconnect() {
+  system().borrowBusObject();
+}
+
+void ConnectionRegistry::reset() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock( r.mutex );
+  r.shared.reset();
+}
+
+long ConnectionRegistry::users() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock( r.mutex );
+  return r.shared ? r.shared.use_count() - 1 : 0;
+}
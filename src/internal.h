@@ -1,36 +1,68 @@
 #pragma once
+#include <algorithm>
 #include <errno.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <systemd/sd-bus.h>
+#include <unordered_map>
 
 namespace dbus {
 
-inline void THROW_EXCEPTION_IF( bool condition, std::string message ) {
+// messages are taken as const char* so the success path never builds a std::string
+inline void THROW_EXCEPTION_IF( bool condition, const char *message ) {
   if ( condition )
     throw std::runtime_error( message );
 }
 
-inline void THROW_EXCEPTION_IF( bool condition, std::string message, int code ) {
+inline void THROW_EXCEPTION_IF( bool condition, const std::string &message ) {
+  if ( condition )
+    throw std::runtime_error( message );
+}
+
+inline void THROW_EXCEPTION_IF( bool condition, const char *message, int code ) {
   if ( condition ) {
     sd_bus_error err = SD_BUS_ERROR_NULL;
     ::sd_bus_error_set_errno( &err, code );
-    std::string throw_message = message + " (" + err.message + ")";
+    std::string throw_message = std::string { message } + " (" + err.message + ")";
     ::sd_bus_error_free( &err );
-    THROW_EXCEPTION_IF( true, message );
+    THROW_EXCEPTION_IF( true, throw_message );
   }
 }
 
-inline void THROW_EXCEPTION_IF( bool condition, std::string message, sd_bus_error *err ) {
+inline void THROW_EXCEPTION_IF( bool condition, const char *message, sd_bus_error *err ) {
   if ( condition ) {
-    std::string s;
-    if ( err ) {
-      s = err->message;
+    std::string throw_message { message };
+    if ( err && err->message )
+      throw_message += " (" + std::string { err->message } + ")";
+    if ( err )
       sd_bus_error_free( err );
-      message += " (" + s + ")";
-    }
-    THROW_EXCEPTION_IF( true, message );
+    THROW_EXCEPTION_IF( true, throw_message );
+  }
+}
+
+// identical header strings share one copy while someone holds it,
+// names nobody uses any more are dropped whenever the table doubled
+inline std::shared_ptr<const std::string> intern( const char *s ) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<const std::string>> table;
+  static std::size_t limit = 64;
+
+  std::lock_guard<std::mutex> lock( mutex );
+  std::weak_ptr<const std::string> &entry = table[s];
+  std::shared_ptr<const std::string> shared = entry.lock();
+  if ( !shared ) {
+    shared = std::make_shared<const std::string>( s );
+    entry = shared;
+  }
+  if ( table.size() >= limit ) {
+    for ( auto it = table.begin(); it != table.end(); )
+      it = it->second.expired() ? table.erase( it ) : std::next( it );
+    limit = std::max<std::size_t>( 64, table.size() * 2 );
   }
+  return shared;
 }
 
 }  // namespace dbus
@@ -0,0 +1,70 @@
+#include "dbuscpp/latency.h"
+
+using namespace dbus;
+
+namespace {
+std::size_t bucketOf( uint64_t usec ) {
+  std::size_t bucket = 0;
+  while ( usec && bucket < LatencyHistogram::BUCKETS - 1 ) {
+    usec >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+}  // namespace
+
+void LatencyHistogram::record( uint64_t usec ) {
+  m_buckets[bucketOf( usec )].fetch_add( 1, std::memory_order_relaxed );
+  m_count.fetch_add( 1, std::memory_order_relaxed );
+  m_sum.fetch_add( usec, std::memory_order_relaxed );
+
+  uint64_t max = m_max.load( std::memory_order_relaxed );
+  while ( usec > max && !m_max.compare_exchange_weak( max, usec, std::memory_order_relaxed ) )
+    ;
+}
+
+void LatencyHistogram::reset() {
+  for ( auto &bucket : m_buckets )
+    bucket.store( 0, std::memory_order_relaxed );
+  m_count.store( 0, std::memory_order_relaxed );
+  m_sum.store( 0, std::memory_order_relaxed );
+  m_max.store( 0, std::memory_order_relaxed );
+}
+
+uint64_t LatencyHistogram::count() const {
+  return m_count.load( std::memory_order_relaxed );
+}
+
+uint64_t LatencyHistogram::max() const {
+  return m_max.load( std::memory_order_relaxed );
+}
+
+double LatencyHistogram::mean() const {
+  uint64_t n = count();
+  return n ? static_cast<double>( m_sum.load( std::memory_order_relaxed ) ) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile( double p ) const {
+  auto b = buckets();
+  uint64_t total = 0;
+  for ( auto n : b )
+    total += n;
+  if ( !total )
+    return 0;
+
+  uint64_t rank = static_cast<uint64_t>( p * total );
+  uint64_t seen = 0;
+  for ( std::size_t i = 0; i < BUCKETS; ++i ) {
+    seen += b[i];
+    if ( seen > rank || seen == total )
+      return i == 0 ? 0 : ( uint64_t { 1 } << i ) - 1;
+  }
+  return max();
+}
+
+std::array<uint64_t, LatencyHistogram::BUCKETS> LatencyHistogram::buckets() const {
+  std::array<uint64_t, BUCKETS> b {};
+  for ( std::size_t i = 0; i < BUCKETS; ++i )
+    b[i] = m_buckets[i].load( std::memory_order_relaxed );
+  return b;
+}
@@ -0,0 +1,292 @@
+#include "dbuscpp/loopback.h"
+#include "internal.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-id128.h>
+#include <unistd.h>
+
+using namespace dbus;
+
+namespace {
+const char *PROPERTIES = "org.freedesktop.DBus.Properties";
+
+std::array<int, 2> socketPair() {
+  std::array<int, 2> fds;
+  int r = ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, fds.data() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create loopback socket pair", errno );
+  return fds;
+}
+
+// one end of the pair, the server end authenticates the other one
+Connection openPeer( int fd, bool server ) {
+  sd_bus *bus = nullptr;
+  int r = ::sd_bus_new( &bus );
+  if ( r < 0 ) {
+    ::close( fd );
+    THROW_EXCEPTION_IF( true, "Failed to create loopback bus", -r );
+  }
+
+  sd_id128_t id;
+  if ( ( r = ::sd_bus_set_fd( bus, fd, fd ) ) >= 0 && server &&
+       ( r = ::sd_id128_randomize( &id ) ) >= 0 )
+    r = ::sd_bus_set_server( bus, 1, id );
+  if ( r >= 0 )
+    r = ::sd_bus_start( bus );
+  if ( r < 0 )
+    ::sd_bus_unref( bus );  // closes the fd
+  THROW_EXCEPTION_IF( r < 0, "Failed to start loopback bus", -r );
+  return Connection::adopt( bus );
+}
+
+// the client end is opened first, the server's fd must not outlive its failure
+Connection openClient( const std::array<int, 2> &fds ) {
+  try {
+    return openPeer( fds[0], false );
+  } catch ( ... ) {
+    ::close( fds[1] );
+    throw;
+  }
+}
+
+std::string text( const char *s ) {
+  return s ? s : "";
+}
+}  // namespace
+
+LoopbackService::LoopbackService() : LoopbackService( socketPair() ) {}
+
+LoopbackService::LoopbackService( std::array<int, 2> fds )
+  : client( openClient( fds ) ), server( openPeer( fds[1], true ) ) {
+  wakeFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  THROW_EXCEPTION_IF( wakeFd < 0, "Failed to create wake-up event", errno );
+
+  int r = ::sd_bus_add_filter( (sd_bus *)server.borrowBusObject(),
+    (sd_bus_slot **)&filter,
+    []( sd_bus_message *m, void *userdata, sd_bus_error * ) {
+      return LoopbackService::dispatch( m, userdata );
+    },
+    this );
+  if ( r < 0 )
+    ::close( wakeFd );
+  THROW_EXCEPTION_IF( r < 0, "Failed to install the loopback dispatcher", -r );
+
+  thread = std::thread { &LoopbackService::loop, this };
+}
+
+LoopbackService::~LoopbackService() {
+  stopRequest = true;
+  ::eventfd_write( wakeFd, 1 );
+  if ( thread.joinable() )
+    thread.join();
+
+  BusLock lock( server, false );
+  filter = ::sd_bus_slot_unref( (sd_bus_slot *)filter );
+  ::close( wakeFd );
+}
+
+Connection LoopbackService::connection() {
+  return client;
+}
+
+void LoopbackService::method( CStringView interface, CStringView member, MethodHandler handler ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  handlers[{ interface.c_str(), member.c_str() }] = std::move( handler );
+}
+
+void LoopbackService::property( CStringView interface,
+  CStringView name,
+  const PropertyValue &value ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  values[{ interface.c_str(), name.c_str() }] = value;
+}
+
+PropertyValue LoopbackService::property( CStringView interface, CStringView name ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  auto it = values.find( { interface.c_str(), name.c_str() } );
+  return it == values.end() ? PropertyValue {} : it->second;
+}
+
+void LoopbackService::delay( std::chrono::microseconds delay ) {
+  delayUsec = delay.count();
+}
+
+Message LoopbackService::signal( CStringView object, CStringView interface, CStringView member ) {
+  BusLock lock( server, false );
+  sd_bus_message *msg = nullptr;
+  int r = ::sd_bus_message_new_signal( (sd_bus *)server.borrowBusObject(),
+    &msg,
+    object.c_str(),
+    interface.c_str(),
+    member.c_str() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create new signal message", -r );
+  return Message { msg };
+}
+
+void LoopbackService::emit( const Message &signal ) {
+  BusLock lock( server, false );
+  int r = ::sd_bus_send( (sd_bus *)server.borrowBusObject(),
+    (sd_bus_message *)signal.borrowBusMessage(),
+    nullptr );
+  THROW_EXCEPTION_IF( r < 0, "Failed to send signal", -r );
+  ::eventfd_write( wakeFd, 1 );  // whatever did not fit is written by the service thread
+}
+
+uint64_t LoopbackService::calls() {
+  return served;
+}
+
+int LoopbackService::dispatch( void *message, void *userdata ) {
+  sd_bus_message *m = (sd_bus_message *)message;
+  if ( !::sd_bus_message_is_method_call( m, nullptr, nullptr ) )
+    return 0;
+
+  LoopbackService *self = static_cast<LoopbackService *>( userdata );
+  try {
+    self->serve( m );
+  } catch ( const std::exception &e ) {
+    ::sd_bus_reply_method_errorf( m, SD_BUS_ERROR_FAILED, "%s", e.what() );
+  }
+  ++self->served;
+  return 1;  // handled, sd-bus does not look for objects
+}
+
+void LoopbackService::serve( void *call ) {
+  sd_bus_message *m = (sd_bus_message *)call;
+  if ( int64_t usec = delayUsec.load( std::memory_order_relaxed ) )
+    std::this_thread::sleep_for( std::chrono::microseconds { usec } );
+
+  std::string interface = text( ::sd_bus_message_get_interface( m ) );
+  std::string member = text( ::sd_bus_message_get_member( m ) );
+  if ( interface == PROPERTIES ) {
+    properties( m );
+    return;
+  }
+
+  sd_bus_message *ret = nullptr;
+  int r = ::sd_bus_message_new_method_return( m, &ret );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create method return", -r );
+  Message reply { ret };
+
+  if ( interface == INTERFACE && member == "Echo" ) {
+    if ( ( r = ::sd_bus_message_rewind( m, 1 ) ) >= 0 )
+      r = ::sd_bus_message_copy( ret, m, 1 );
+    THROW_EXCEPTION_IF( r < 0, "Failed to copy the arguments", -r );
+  } else {
+    MethodHandler handler;
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      auto it = handlers.find( { interface, member } );
+      if ( it != handlers.end() )
+        handler = it->second;
+    }
+    if ( !handler ) {
+      ::sd_bus_reply_method_errorf(
+        m, SD_BUS_ERROR_UNKNOWN_METHOD, "Unknown method %s.%s", interface.c_str(), member.c_str() );
+      return;
+    }
+    Reply arguments { ::sd_bus_message_ref( m ) };
+    handler( arguments, reply );
+  }
+
+  r = ::sd_bus_send( nullptr, ret, nullptr );
+  THROW_EXCEPTION_IF( r < 0, "Failed to send method return", -r );
+}
+
+void LoopbackService::properties( void *call ) {
+  sd_bus_message *m = (sd_bus_message *)call;
+  Reply arguments { ::sd_bus_message_ref( m ) };
+  std::string member = arguments.member();
+  std::string interface, name;
+
+  sd_bus_message *ret = nullptr;
+  int r = ::sd_bus_message_new_method_return( m, &ret );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create method return", -r );
+  Message reply { ret };
+
+  arguments.read( interface );
+  if ( member == "Get" ) {
+    arguments.read( name );
+    PropertyValue value = property( interface, name );
+    if ( value.index() == 0 ) {
+      ::sd_bus_reply_method_errorf( m,
+        SD_BUS_ERROR_UNKNOWN_PROPERTY,
+        "Unknown property %s.%s",
+        interface.c_str(),
+        name.c_str() );
+      return;
+    }
+    writeVariant( reply, value );
+  } else if ( member == "GetAll" ) {
+    std::lock_guard<std::mutex> lock( mutex );
+    reply.openContainer( DATA_TYPE::ARRAY, "{sv}" );
+    for ( auto it = values.lower_bound( { interface, "" } );
+          it != values.end() && it->first.first == interface;
+          ++it ) {
+      reply.openContainer( DATA_TYPE::DICT_ENTRY, "sv" );
+      reply.write( it->first.second );
+      writeVariant( reply, it->second );
+      reply.closeContainer();
+    }
+    reply.closeContainer();
+  } else if ( member == "Set" ) {
+    PropertyValue value;
+    arguments.read( name );
+    if ( !readVariant( arguments, value ) ) {
+      ::sd_bus_reply_method_errorf(
+        m, SD_BUS_ERROR_INVALID_ARGS, "Only basic types can be set on %s", name.c_str() );
+      return;
+    }
+    property( interface, name, value );
+
+    Message changed =
+      signal( text( ::sd_bus_message_get_path( m ) ), PROPERTIES, "PropertiesChanged" );
+    changed.write( interface );
+    changed.openContainer( DATA_TYPE::ARRAY, "{sv}" );
+    changed.openContainer( DATA_TYPE::DICT_ENTRY, "sv" );
+    changed.write( name );
+    writeVariant( changed, value );
+    changed.closeContainer();
+    changed.closeContainer();
+    changed.openContainer( DATA_TYPE::ARRAY, DATA_TYPE::STRING );
+    changed.closeContainer();
+    emit( changed );
+  } else {
+    ::sd_bus_reply_method_errorf(
+      m, SD_BUS_ERROR_UNKNOWN_METHOD, "Unknown method %s.%s", PROPERTIES, member.c_str() );
+    return;
+  }
+
+  r = ::sd_bus_send( nullptr, ret, nullptr );
+  THROW_EXCEPTION_IF( r < 0, "Failed to send method return", -r );
+}
+
+void LoopbackService::loop() {
+  sd_bus *bus = (sd_bus *)server.borrowBusObject();
+  struct pollfd p[2];
+  p[0].fd = ::sd_bus_get_fd( bus );
+  p[1].fd = wakeFd;
+  p[1].events = POLLIN;
+
+  while ( !stopRequest ) {
+    int r = 0;
+    {
+      BusLock lock( server, false );
+      r = ::sd_bus_process( bus, nullptr );
+      p[0].events = static_cast<short int>( ::sd_bus_get_events( bus ) );
+    }
+    if ( r < 0 )
+      break;  // the client end was closed
+    if ( r > 0 )
+      continue;
+
+    poll( p, 2, -1 );
+    if ( p[1].revents & POLLIN ) {
+      eventfd_t value;
+      ::eventfd_read( wakeFd, &value );
+    }
+  }
+}
@@ -1,16 +1,61 @@
 #include "dbuscpp/manager.h"
+#include "dbuscpp/recorder.h"
 #include "internal.h"
+#include <cerrno>
+#include <cstring>
 #include <systemd/sd-bus.h>
+#include <utility>
 
 using namespace dbus;
 
-Manager::Manager() : conn( ConnectionType::NEW_SYSTEM_DBUS ) {}
+namespace {
+struct BatchSlot {
+  BatchResult *result = nullptr;
+  std::size_t *pending = nullptr;
+  bool done = false;
+};
+
+int batch_callback( sd_bus_message *m, void *userdata, sd_bus_error *error ) {
+  std::ignore = error;
+  BatchSlot *slot = static_cast<BatchSlot *>( userdata );
+
+  if ( ::sd_bus_message_is_method_error( m, nullptr ) ) {
+    const sd_bus_error *e = ::sd_bus_message_get_error( m );
+    int errnum = ::sd_bus_message_get_errno( m );
+    slot->result->error = errnum > 0 ? errnum : EIO;
+    if ( e && e->name )
+      slot->result->errorName = e->name;
+    if ( e && e->message )
+      slot->result->errorMessage = e->message;
+    else if ( e && e->name )
+      slot->result->errorMessage = e->name;
+  }
+  slot->result->reply = Reply { ::sd_bus_message_ref( m ) };
+  slot->done = true;
+  --*slot->pending;
+  return 0;
+}
+
+// cancels the calls still queued when callBatch returns or unwinds, their callbacks
+// point into its stack
+struct SlotGuard {
+  std::vector<sd_bus_slot *> &handles;
+  ~SlotGuard() {
+    for ( auto &h : handles )
+      h = ::sd_bus_slot_unref( h );
+  }
+};
+}  // namespace
+
+Manager::Manager() : conn( ConnectionType::SHARED_SYSTEM_DBUS ) {}
 
 Manager::Manager( int connectionType ) : conn( connectionType ) {}
 
-Manager::Manager( const Manager &m ) {
-  conn = m.conn;
-}
+Manager::Manager( const Connection &connection ) : conn( connection ) {}
+
+Manager::Manager( const Manager &m ) : conn( m.conn ) {}
+
+Manager::Manager( Manager &&m ) noexcept : conn( std::move( m.conn ) ) {}
 
 Manager &Manager::operator=( const Manager &rhs ) {
   if ( this == &rhs )
@@ -20,12 +65,26 @@ Manager &Manager::operator=( const Manager &rhs ) {
   return *this;
 }
 
-Message Manager::methodCall( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member ) {
-  std::lock_guard<std::mutex> lock( mutex );
+Manager &Manager::operator=( Manager &&rhs ) noexcept {
+  if ( this == &rhs )
+    return *this;
+
+  conn = std::move( rhs.conn );
+  return *this;
+}
+
+Message Manager::methodCall( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
+  BusLock lock( conn );
+  return newMethodCall( service, object, interface, member );
+}
 
+Message Manager::newMethodCall( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
   sd_bus_message *msg = nullptr;
 
   int r = ::sd_bus_message_new_method_call( (sd_bus *)conn.borrowBusObject(),
@@ -39,61 +98,42 @@ Message Manager::methodCall( std::string service,
   return Message { msg };
 }
 
-Reply Manager::propertyGet( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member ) {
-  std::lock_guard<std::mutex> lock( mutex );
-
-  ::sd_bus_error err = SD_BUS_ERROR_NULL;
-  sd_bus_message *reply = nullptr;
-
-  int r = ::sd_bus_call_method( (sd_bus *)conn.borrowBusObject(),
-    service.c_str(),
-    object.c_str(),
-    "org.freedesktop.DBus.Properties",
-    "Get",
-    &err,
-    (sd_bus_message **)&reply,
-    "ss",
-    interface.c_str(),
-    member.c_str() );
-
-  THROW_EXCEPTION_IF( r < 0, "Failed to create new method call", &err );
-
-  return Reply { reply };
+Reply Manager::propertyGet( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
+  Message m = methodCall( service, object, "org.freedesktop.DBus.Properties", "Get" );
+  m.write( interface.c_str() );
+  m.write( member.c_str() );
+  return call( m );
 }
 
-Message Manager::propertySet( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member ) {
-  std::lock_guard<std::mutex> lock( mutex );
-
-  sd_bus_message *msg = nullptr;
-
-  int r = ::sd_bus_message_new_method_call( (sd_bus *)conn.borrowBusObject(),
-    (sd_bus_message **)&msg,
-    service.c_str(),
-    object.c_str(),
-    "org.freedesktop.DBus.Properties",
-    "Set" );
-
-  THROW_EXCEPTION_IF( r < 0, "Failed to create new method call message", -r );
-
-  r = ::sd_bus_message_append( (sd_bus_message *)msg, "ss", interface.c_str(), member.c_str() );
-
-  THROW_EXCEPTION_IF( r < 0, "Failed to create new method call message", -r );
+Reply Manager::propertyGetAll( CStringView service, CStringView object, CStringView interface ) {
+  Message m = methodCall( service, object, "org.freedesktop.DBus.Properties", "GetAll" );
+  m.write( interface.c_str() );
+  return call( m );
+}
 
-  return Message { msg };
+Message Manager::propertySet( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member ) {
+  Message m = methodCall( service, object, "org.freedesktop.DBus.Properties", "Set" );
+  m.write( interface.c_str() );
+  m.write( member.c_str() );
+  return m;
 }
 
-Reply Manager::call( Message m ) {
-  std::lock_guard<std::mutex> lock( mutex );
+Reply Manager::call( const Message &m ) {
+  BusLock lock( conn );
 
   ::sd_bus_error err = SD_BUS_ERROR_NULL;
 
   sd_bus_message *reply = nullptr;
+  // sd_bus_call queues behind what is waiting and only returns once the call was written,
+  // so it is admitted like any send and never stays in the tracked queue
+  conn.admit( m.size() );
+  uint64_t sentAt = conn.tracing() ? Recorder::now() : 0;
 
   int r = ::sd_bus_call( (sd_bus *)conn.borrowBusObject(),
     (sd_bus_message *)m.borrowBusMessage(),
@@ -101,15 +141,50 @@ Reply Manager::call( Message m ) {
     &err,
     (sd_bus_message **)&reply );
 
+  // sd_bus_call takes its reply off the socket itself, past the recorder's filter
+  if ( sentAt ) {
+    conn.trace( m.borrowBusMessage(), RecordDirection::RECORD_SENT, sentAt );
+    if ( reply )
+      conn.trace( reply, RecordDirection::RECORD_RECEIVED );
+  }
+
   THROW_EXCEPTION_IF( r < 0, "Failed to create new method call", &err );
 
   return Reply { reply };
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+Connection &Manager::connection() {
+  return conn;
+}
+
+void Manager::send( const Message &m ) {
+  BusLock lock( conn );
+  enqueue( m );
+  flush();
+}
+
+void Manager::enqueue( const Message &m ) {
+  sd_bus_message *msg = (sd_bus_message *)m.borrowBusMessage();
+
+  int r = ::sd_bus_message_set_expect_reply( msg, 0 );
+  THROW_EXCEPTION_IF( r < 0, "Failed to clear the reply expected flag", -r );
+
+  conn.admit( m.size() );
+  r = ::sd_bus_send( (sd_bus *)conn.borrowBusObject(), msg, nullptr );
+  THROW_EXCEPTION_IF( r < 0, "Failed to send message", -r );
+  conn.sent( m.size() );
+  conn.trace( msg, RecordDirection::RECORD_SENT );
+}
+
+void Manager::flush() {
+  int r = ::sd_bus_flush( (sd_bus *)conn.borrowBusObject() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to flush bus", -r );
+}
+
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   bool &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::BOOLEAN );
@@ -117,10 +192,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int16_t &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::INT16 );
@@ -128,10 +203,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int32_t &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::INT32 );
@@ -139,10 +214,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int64_t &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::INT64 );
@@ -150,10 +225,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   double &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::DOUBLE );
@@ -161,10 +236,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   std::string &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::STRING );
@@ -172,10 +247,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertyGetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertyGetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   ObjectPath &value ) {
   Reply reply = propertyGet( service, object, interface, member );
   reply.enterContainer( DATA_TYPE::VARIANT, DATA_TYPE::OBJECT_PATH );
@@ -183,10 +258,10 @@ void Manager::propertyGetDirect( std::string service,
   reply.exitContainer();
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   bool value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, DATA_TYPE::BOOLEAN );
@@ -195,10 +270,10 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int16_t value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, std::string { DATA_TYPE::INT16 } );
@@ -207,10 +282,10 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int32_t value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, DATA_TYPE::INT32 );
@@ -219,10 +294,10 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   int64_t value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, DATA_TYPE::INT64 );
@@ -231,10 +306,10 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
   double value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, DATA_TYPE::DOUBLE );
@@ -243,11 +318,11 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-void Manager::propertySetDirect( std::string service,
-  std::string object,
-  std::string interface,
-  std::string member,
-  std::string value ) {
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
+  std::string_view value ) {
   Message m = propertySet( service, object, interface, member );
   m.openContainer( DATA_TYPE::VARIANT, DATA_TYPE::STRING );
   m.write( value );
@@ -255,15 +330,115 @@ void Manager::propertySetDirect( std::string service,
   call( m );
 }
 
-std::vector<ObjectPath> Manager::objects( std::string service ) {
+void Manager::propertySetDirect( CStringView service,
+  CStringView object,
+  CStringView interface,
+  CStringView member,
+  const char *value ) {
+  propertySetDirect( service, object, interface, member, std::string_view { value } );
+}
+
+std::vector<BatchResult> Manager::callBatch( const std::vector<Message> &messages ) {
+  BusLock lock( conn );
+  sd_bus *bus = (sd_bus *)conn.borrowBusObject();
+
+  std::vector<BatchResult> results( messages.size() );
+  std::vector<BatchSlot> slots( messages.size() );
+  std::vector<sd_bus_slot *> handles( messages.size(), nullptr );
+  SlotGuard guard { handles };
+  std::size_t pending = 0;
+
+  // queue everything first, sd-bus writes as much as the socket takes
+  for ( std::size_t i = 0; i < messages.size(); ++i ) {
+    slots[i].result = &results[i];
+    slots[i].pending = &pending;
+    try {
+      conn.admit( messages[i].size() );
+    } catch ( const std::exception &e ) {
+      results[i].error = ENOBUFS;
+      results[i].errorMessage = e.what();
+      slots[i].done = true;
+      continue;
+    }
+    int r = ::sd_bus_call_async( bus,
+      &handles[i],
+      (sd_bus_message *)messages[i].borrowBusMessage(),
+      batch_callback,
+      &slots[i],
+      0 );
+    if ( r < 0 ) {
+      results[i].error = -r;
+      results[i].errorMessage = std::strerror( -r );
+      slots[i].done = true;
+    } else {
+      conn.sent( messages[i].size() );
+      conn.trace( messages[i].borrowBusMessage(), RecordDirection::RECORD_SENT );
+      ++pending;
+    }
+  }
+
+  int r = 0;
+  while ( pending > 0 ) {
+    r = ::sd_bus_process( bus, nullptr );
+    if ( r < 0 )
+      break;
+    if ( r > 0 )
+      continue;
+    r = ::sd_bus_wait( bus, UINT64_MAX );
+    if ( r < 0 )
+      break;
+  }
+
+  // the guard cancels the calls left when the connection failed
+  for ( std::size_t i = 0; i < messages.size(); ++i ) {
+    if ( !slots[i].done ) {
+      results[i].error = -r;
+      results[i].errorMessage = std::strerror( -r );
+    }
+  }
+
+  return results;
+}
+
+std::vector<BatchResult> Manager::propertyGetBatch( const std::vector<PropertyRequest> &requests ) {
+  std::vector<Message> messages;
+  messages.reserve( requests.size() );
+  for ( auto &req : requests ) {
+    Message m = methodCall( req.service, req.object, "org.freedesktop.DBus.Properties", "Get" );
+    m.write( req.interface );
+    m.write( req.member );
+    messages.push_back( std::move( m ) );
+  }
+
+  std::vector<BatchResult> results = callBatch( messages );
+  for ( auto &result : results )
+    if ( result.ok() )
+      readVariant( result.reply, result.value );
+
+  return results;
+}
+
+std::vector<BatchResult> Manager::propertySetBatch( const std::vector<PropertyRequest> &requests ) {
+  std::vector<Message> messages;
+  messages.reserve( requests.size() );
+  for ( auto &req : requests ) {
+    Message m = propertySet( req.service, req.object, req.interface, req.member );
+    writeVariant( m, req.value );
+    messages.push_back( std::move( m ) );
+  }
+
+  return callBatch( messages );
+}
+
+// only the paths are wanted, each object's interfaces are skipped in one go
+std::vector<ObjectPath> Manager::objects( CStringView service ) {
   std::vector<ObjectPath> objects;
   ObjectPath object;
   Message msg =
     methodCall( service, "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects" );
-  Reply reply = call( msg );  // a{oa{sa{sv}}}
+  Reply reply = call( msg );
 
-  if ( !( reply.signatureType() == DATA_TYPE::ARRAY ) &&
-       ( reply.signatureContents() == "{oa{sa{sv}}}" ) )
+  if ( !reply.hasSignature( "a{oa{sa{sv}}}" ) )
     return objects;  // something's wrong!
 
   reply.enterContainer( DATA_TYPE::ARRAY, "{oa{sa{sv}}}" );
@@ -278,3 +453,32 @@ std::vector<ObjectPath> Manager::objects( std::string service ) {
   reply.exitContainer();  // top container
   return objects;
 }
+
+std::size_t Manager::objects( CStringView service, const ObjectVisitor &visitor ) {
+  std::size_t visited = 0;
+  ObjectPath object;
+  Message msg =
+    methodCall( service, "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects" );
+  Reply reply = call( msg );
+
+  if ( !reply.hasSignature( "a{oa{sa{sv}}}" ) )
+    return visited;  // something's wrong!
+
+  reply.enterContainer( DATA_TYPE::ARRAY, "{oa{sa{sv}}}" );
+
+  while ( reply.enterContainerIf( DATA_TYPE::DICT_ENTRY, "oa{sa{sv}}" ) ) {
+    reply.read( object );  // reuses the string's storage
+    bool more = true;
+    {
+      DictRange<std::string_view> interfaces { reply };
+      more = visitor( object, interfaces );
+      ++visited;
+    }  // skips the interfaces left unread
+    if ( !more )
+      return visited;  // the rest of the reply is dropped with it
+    reply.exitContainer();
+  }
+
+  reply.exitContainer();  // top container
+  return visited;
+}
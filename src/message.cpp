@@ -1,12 +1,62 @@
 
 #include "dbuscpp/message.h"
+#include "dbuscpp/type_tree.h"
 #include "internal.h"
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <systemd/sd-bus.h>
+#include <utility>
 
 using namespace dbus;
 
+namespace {
+// what sd-bus checks for strings it copies itself: valid UTF-8 without embedded NUL,
+// no overlong forms, no surrogates and nothing above U+10FFFF
+bool string_valid( std::string_view value ) {
+  const auto *p = (const unsigned char *)value.data();
+  const auto *end = p + value.size();
+
+  while ( p < end ) {
+    unsigned char c = *p;
+    if ( c == 0 )
+      return false;
+    if ( c < 0x80 ) {
+      ++p;
+      continue;
+    }
+
+    std::size_t length;
+    char32_t code;
+    if ( ( c & 0xe0 ) == 0xc0 ) {
+      length = 2;
+      code = c & 0x1f;
+    } else if ( ( c & 0xf0 ) == 0xe0 ) {
+      length = 3;
+      code = c & 0x0f;
+    } else if ( ( c & 0xf8 ) == 0xf0 ) {
+      length = 4;
+      code = c & 0x07;
+    } else
+      return false;
+
+    if ( (std::size_t)( end - p ) < length )
+      return false;
+    for ( std::size_t i = 1; i < length; ++i ) {
+      if ( ( p[i] & 0xc0 ) != 0x80 )
+        return false;
+      code = ( code << 6 ) | ( p[i] & 0x3f );
+    }
+
+    static const char32_t least[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    if ( code < least[length] || code > 0x10ffff || ( code >= 0xd800 && code <= 0xdfff ) )
+      return false;
+    p += length;
+  }
+  return true;
+}
+}  // namespace
+
 Message::Message() {}
 
 Message::Message( void *message ) {
@@ -18,6 +68,7 @@ Message::Message( const Message &other ) {
   if ( msg )
     msg = ::sd_bus_message_unref( (sd_bus_message *)msg );
   msg = ::sd_bus_message_ref( (sd_bus_message *)other.msg );
+  m_size = other.m_size;
 }
 
 Message &Message::operator=( const Message &rhs ) {
@@ -28,6 +79,22 @@ Message &Message::operator=( const Message &rhs ) {
   if ( msg )
     msg = ::sd_bus_message_unref( (sd_bus_message *)msg );
   msg = ::sd_bus_message_ref( (sd_bus_message *)rhs.msg );
+  m_size = rhs.m_size;
+  return *this;
+}
+
+Message::Message( Message &&other ) noexcept
+  : msg { std::exchange( other.msg, nullptr ) }, m_size { other.m_size } {}
+
+Message &Message::operator=( Message &&rhs ) noexcept {
+  if ( this == &rhs )
+    return *this;
+  std::lock_guard<std::mutex> lock( mutex );
+
+  if ( msg )
+    msg = ::sd_bus_message_unref( (sd_bus_message *)msg );
+  msg = std::exchange( rhs.msg, nullptr );
+  m_size = rhs.m_size;
   return *this;
 }
 
@@ -48,37 +115,11 @@ int Message::type() {
   return msg_type;
 }
 
-bool Message::signatureValid( std::string signature ) {
-  // TODO make this check smarter
-  bool is_valid = false;
-  for ( const char c : signature ) {
-    if ( c == static_cast<char>( DATA_TYPE::BYTE ) ||
-         c == static_cast<char>( DATA_TYPE::BOOLEAN ) ||
-         c == static_cast<char>( DATA_TYPE::INT16 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT16 ) ||
-         c == static_cast<char>( DATA_TYPE::INT32 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT32 ) ||
-         c == static_cast<char>( DATA_TYPE::INT64 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT64 ) ||
-         c == static_cast<char>( DATA_TYPE::DOUBLE ) ||
-         c == static_cast<char>( DATA_TYPE::STRING ) ||
-         c == static_cast<char>( DATA_TYPE::OBJECT_PATH ) ||
-         c == static_cast<char>( DATA_TYPE::SIGNATURE ) ||
-         c == static_cast<char>( DATA_TYPE::UNIX_FD ) ||
-         c == static_cast<char>( DATA_TYPE::ARRAY ) ||
-         c == static_cast<char>( DATA_TYPE::VARIANT ) ||
-         c == static_cast<char>( DATA_TYPE::STRUCT_BEGIN ) ||
-         c == static_cast<char>( DATA_TYPE::STRUCT_END ) ||
-         c == static_cast<char>( DATA_TYPE::DICT_ENTRY_BEGIN ) ||
-         c == static_cast<char>( DATA_TYPE::DICT_ENTRY_END ) )
-      is_valid = true;
-    else
-      return false;  // no point of continuing the loop
-  }
-  return is_valid;
+bool Message::signatureValid( std::string_view signature ) {
+  return validSignature( signature );
 }
 
-bool Message::hasSignature( std::string signature ) {
+bool Message::hasSignature( CStringView signature ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_has_signature(
     (sd_bus_message *)msg, signature.c_str() );  // returns 1 if match
@@ -110,18 +151,16 @@ std::string Message::signatureContents() {
 }
 
 void Message::openContainer( char type, char content ) {
-  std::string contents = { content };
+  const char contents[] = { content, '\0' };
   openContainer( type, contents );
 }
 
-void Message::openContainer( char type, std::string contents ) {
-  int r = ::sd_bus_message_open_container( (sd_bus_message *)msg, type, contents.c_str() );
-  THROW_EXCEPTION_IF( r < 0, "Failed to open container", -r );
+void Message::openContainer( char type, CStringView contents ) {
+  open( type, contents.c_str() );
 }
 
 void Message::closeContainer() {
-  int r = ::sd_bus_message_close_container( (sd_bus_message *)msg );
-  THROW_EXCEPTION_IF( r < 0, "Failed to close container", -r );
+  close();
 }
 
 std::string Message::sender() {
@@ -169,84 +208,139 @@ void Message::write( bool value ) {
   int temp = value;
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_BOOLEAN, &temp );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( temp );
 }
 
 void Message::write( int16_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_INT16, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( int32_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_INT32, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( int64_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_INT64, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( uint8_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_BYTE, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( uint16_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_UINT16, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( uint32_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_UINT32, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( uint64_t value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_UINT64, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
 void Message::write( double value ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_DOUBLE, &value );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += sizeof( value );
 }
 
-void Message::write( std::string value ) {
+// the string is copied straight into the message body, no temporary string is built.
+// sd-bus does not look at the reserved space, it is validated here before the copy.
+void Message::write( std::string_view value ) {
+  THROW_EXCEPTION_IF( !string_valid( value ), "Failed to write message value", -EINVAL );
+
   std::lock_guard<std::mutex> lock( mutex );
-  int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_STRING, value.c_str() );
+  char *p = nullptr;
+  int r = ::sd_bus_message_append_string_space( (sd_bus_message *)msg, value.size(), &p );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += value.size();
+  std::memcpy( p, value.data(), value.size() );
 }
 
-void Message::write( std::vector<std::byte> value ) {
+void Message::write( const char *value ) {
   std::lock_guard<std::mutex> lock( mutex );
-  uint8_t p = 0;
-  int r = 0;
-  openContainer( DATA_TYPE::ARRAY, DATA_TYPE::BYTE );
+  int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_STRING, value );
+  THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += value ? std::strlen( value ) : 0;  // sd-bus writes NULL as ""
+}
 
-  for ( auto &i : value ) {
-    p = static_cast<uint8_t>( i );
-    r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, SD_BUS_TYPE_BYTE, &p );
-    THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
-  }
-  closeContainer();
+void Message::write( const std::string &value ) {
+  write( value.c_str() );
 }
 
-void Message::write( ObjectPath objectPath ) {
+void Message::write( const std::vector<std::byte> &value ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  int r = ::sd_bus_message_append_array(
+    (sd_bus_message *)msg, SD_BUS_TYPE_BYTE, value.data(), value.size() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += value.size();
+}
+
+void Message::write( const ObjectPath &objectPath ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_append_basic(
     (sd_bus_message *)msg, SD_BUS_TYPE_OBJECT_PATH, objectPath.c_str() );
   THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += objectPath.size();
+}
+
+std::size_t Message::size() const {
+  sd_bus_message *m = (sd_bus_message *)msg;
+  if ( !m )
+    return m_size;
+
+  // 16 fixed bytes, then every field: code, signature, length, string, NUL, 8-aligned
+  auto field = []( const char *value ) -> std::size_t {
+    return value ? ( 8 + std::strlen( value ) + 1 + 7 ) & ~std::size_t { 7 } : 0;
+  };
+  std::size_t header = 16 + field( ::sd_bus_message_get_path( m ) ) +
+                       field( ::sd_bus_message_get_interface( m ) ) +
+                       field( ::sd_bus_message_get_member( m ) ) +
+                       field( ::sd_bus_message_get_destination( m ) ) +
+                       field( ::sd_bus_message_get_signature( m, 1 ) );
+  return header + m_size;
+}
+
+void Message::append( char type, const void *value, std::size_t size ) {
+  int r = ::sd_bus_message_append_basic( (sd_bus_message *)msg, type, value );
+  THROW_EXCEPTION_IF( r < 0, "Failed to write message value", -r );
+  m_size += size;
+}
+
+void Message::open( char type, const char *contents ) {
+  int r = ::sd_bus_message_open_container( (sd_bus_message *)msg, type, contents );
+  THROW_EXCEPTION_IF( r < 0, "Failed to open container", -r );
+}
+
+void Message::close() {
+  int r = ::sd_bus_message_close_container( (sd_bus_message *)msg );
+  THROW_EXCEPTION_IF( r < 0, "Failed to close container", -r );
 }
 
-void *Message::borrowBusMessage() {
+void *Message::borrowBusMessage() const {
   THROW_EXCEPTION_IF( !msg, "Attempt to aqcuire a null message pointer" );
   return msg;
 }
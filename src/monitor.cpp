@@ -0,0 +1,172 @@
+#include "dbuscpp/monitor.h"
+#include "internal.h"
+#include <cstring>
+#include <sys/poll.h>
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+Monitor::Monitor( std::size_t capacity ) {
+  std::size_t n = 1;
+  while ( n < capacity )
+    n <<= 1;
+  slots = std::make_unique<std::atomic<void *>[]>( n );
+  mask = n - 1;
+}
+
+Monitor::~Monitor() {
+  stop();
+  for ( std::size_t i = 0; i <= mask; ++i )
+    ::sd_bus_message_unref( (sd_bus_message *)slots[i].exchange( nullptr ) );
+}
+
+void Monitor::start( const std::vector<std::string> &rules ) {
+  if ( thread.joinable() )
+    return;
+
+  conn = std::make_unique<Connection>( ConnectionType::NEW_SYSTEM_DBUS, ConnectionOption::MONITOR );
+  sd_bus *bus = (sd_bus *)conn->borrowBusObject();
+
+  sd_bus_message *m = nullptr;
+  int r = ::sd_bus_message_new_method_call( bus,
+    &m,
+    "org.freedesktop.DBus",
+    "/org/freedesktop/DBus",
+    "org.freedesktop.DBus.Monitoring",
+    "BecomeMonitor" );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create new method call", -r );
+
+  if ( ( r = ::sd_bus_message_open_container( m, DATA_TYPE::ARRAY, "s" ) ) >= 0 ) {
+    for ( auto &rule : rules )
+      if ( ( r = ::sd_bus_message_append_basic( m, DATA_TYPE::STRING, rule.c_str() ) ) < 0 )
+        break;
+  }
+  uint32_t flags = 0;
+  if ( r >= 0 && ( r = ::sd_bus_message_close_container( m ) ) >= 0 )
+    r = ::sd_bus_message_append_basic( m, DATA_TYPE::UINT32, &flags );
+  if ( r < 0 )
+    ::sd_bus_message_unref( m );
+  THROW_EXCEPTION_IF( r < 0, "Failed to write BecomeMonitor arguments", -r );
+
+  ::sd_bus_error err = SD_BUS_ERROR_NULL;
+  r = ::sd_bus_call( bus, m, 0, &err, nullptr );
+  ::sd_bus_message_unref( m );
+  THROW_EXCEPTION_IF( r < 0, "Failed to become a monitor", &err );
+
+  const char *unique = nullptr;
+  ::sd_bus_get_unique_name( bus, &unique );
+  uniqueName = unique ? unique : "";
+
+  r = ::sd_bus_add_filter(
+    bus,
+    (sd_bus_slot **)&filterSlot,
+    []( sd_bus_message *msg, void *userdata, sd_bus_error * ) {
+      return Monitor::filter( msg, userdata );
+    },
+    this );
+  THROW_EXCEPTION_IF( r < 0, "Failed to install the monitor filter", -r );
+
+  stopRequest = false;
+  thread = std::thread { &Monitor::loop, this };
+}
+
+void Monitor::stop() {
+  stopRequest = true;
+  if ( thread.joinable() )
+    thread.join();
+  std::lock_guard<std::mutex> lock( drainMutex );
+  filterSlot = ::sd_bus_slot_unref( (sd_bus_slot *)filterSlot );
+  conn.reset();  // the captured messages keep their bus alive
+}
+
+bool Monitor::running() {
+  return thread.joinable() && !stopRequest;
+}
+
+std::size_t Monitor::drain( const std::function<void( Reply &message )> &visit ) {
+  std::lock_guard<std::mutex> lock( drainMutex );
+  // no other thread touches the bus once the monitor is stopped
+  std::unique_ptr<BusLock> busLock;
+  if ( conn )
+    busLock = std::make_unique<BusLock>( *conn, false );
+
+  uint64_t h = head.load( std::memory_order_acquire );
+  uint64_t from = h - tail > mask + 1 ? h - ( mask + 1 ) : tail;
+  tail = h;
+
+  std::size_t visited = 0;
+  // a slot the monitor thread refilled meanwhile hands over the newer message
+  for ( uint64_t i = from; i < h; ++i ) {
+    void *m = slots[i & mask].exchange( nullptr, std::memory_order_acq_rel );
+    if ( !m )
+      continue;
+    Reply message { m };  // released under the lock
+    visit( message );
+    ++visited;
+  }
+  return visited;
+}
+
+std::size_t Monitor::capacity() const {
+  return mask + 1;
+}
+
+uint64_t Monitor::captured() const {
+  return m_captured.load( std::memory_order_relaxed );
+}
+
+uint64_t Monitor::overwritten() const {
+  return m_overwritten.load( std::memory_order_relaxed );
+}
+
+// runs inside sd_bus_process for every message, only takes a reference
+int Monitor::filter( void *message, void *userdata ) {
+  Monitor *self = static_cast<Monitor *>( userdata );
+  sd_bus_message *m = (sd_bus_message *)message;
+
+  // NameLost and friends for the monitor connection itself
+  const char *destination = ::sd_bus_message_get_destination( m );
+  if ( destination && self->uniqueName == destination )
+    return 0;
+
+  self->pending.push_back( ::sd_bus_message_ref( m ) );
+  return 0;
+}
+
+void Monitor::loop() {
+  sd_bus *bus = (sd_bus *)conn->borrowBusObject();
+  struct pollfd p;
+  p.fd = ::sd_bus_get_fd( bus );
+
+  while ( !stopRequest ) {
+    int r = 0;
+    {
+      BusLock busLock { *conn, false };  // drain() releases messages under it
+      r = ::sd_bus_process( bus, nullptr );
+      publish();
+    }
+    if ( r < 0 )
+      break;  // disconnected
+    if ( r > 0 )
+      continue;
+
+    p.events = static_cast<short int>( ::sd_bus_get_events( bus ) );
+    poll( &p, 1, 100 );  // time in milliseconds, bounds the wait for stop()
+  }
+  stopRequest = true;
+}
+
+// sd_bus_process dropped its references, ours are the only ones left to hand over
+void Monitor::publish() {
+  for ( void *m : pending ) {
+    uint64_t h = head.load( std::memory_order_relaxed );
+    void *old = slots[h & mask].exchange( m, std::memory_order_acq_rel );
+    head.store( h + 1, std::memory_order_release );
+    if ( old ) {
+      ::sd_bus_message_unref( (sd_bus_message *)old );
+      m_overwritten.fetch_add( 1, std::memory_order_relaxed );
+    }
+  }
+  m_captured.fetch_add( pending.size(), std::memory_order_relaxed );
+  pending.clear();
+}
@@ -0,0 +1,135 @@
+#include "dbuscpp/name_owner_cache.h"
+#include "internal.h"
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+using namespace dbus;
+
+namespace {
+// how long to wait for the broker to accept the NameOwnerChanged match, as for a reply
+const std::chrono::seconds MATCH_TIMEOUT { 25 };
+}  // namespace
+
+NameOwnerCache::NameOwnerCache( Manager &manager ) : manager( manager ) {
+  reconnectCallback = SignalGroup::registerReconnect( [this]() { clear(); } );
+}
+
+NameOwnerCache::~NameOwnerCache() {
+  SignalGroup::unregisterReconnect( reconnectCallback );  // before the lock, it may wait
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    for ( auto &n : names )
+      SignalGroup::remove( n.second.signal );
+  }
+  SignalGroup::synchronize();  // an ownerChanged() running meanwhile has returned
+}
+
+std::string NameOwnerCache::resolve( CStringView name ) {
+  std::string key { name.c_str() };
+  SignalID signal;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    auto it = names.find( key );
+    if ( it != names.end() && it->second.resolved )
+      return it->second.owner;
+
+    if ( it != names.end() ) {
+      signal = it->second.signal;
+    } else {
+      Entry entry;
+      entry.signal = SignalGroup::createSignal();
+      SignalGroup::matchRule( entry.signal,
+        "type='signal',sender='org.freedesktop.DBus',path='/org/freedesktop/DBus',"
+        "interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0='" +
+          key + "'" );
+      SignalGroup::signalMessageCallback(
+        entry.signal, [this]( SignalID, Reply &message ) { ownerChanged( message ); } );
+      SignalGroup::add( entry.signal );
+      signal = entry.signal;
+      names.emplace( key, entry );
+    }
+  }
+  SignalGroup::start();
+
+  // the match goes out on the loop's bus, possibly not this Manager's: only once the broker
+  // accepted it is an owner change after the answer below sure to be reported
+  bool watched = SignalGroup::installed( signal, MATCH_TIMEOUT );
+
+  // a batch of one reports the error name, only "no owner" is an answer worth caching
+  Message m = manager.methodCall(
+    "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner" );
+  m.write( name.c_str() );
+  BatchResult result = std::move( manager.callBatch( { m } ).front() );
+
+  std::string owner;
+  if ( result.ok() )
+    result.reply.read( owner );
+  else
+    THROW_EXCEPTION_IF( result.errorName != "org.freedesktop.DBus.Error.NameHasNoOwner",
+      "Failed to resolve name owner (" + result.errorMessage + ")" );
+
+  std::lock_guard<std::mutex> lock( mutex );
+  auto it = names.find( key );
+  if ( it == names.end() || !watched )
+    return owner;  // not kept, asked again next time
+  if ( !it->second.resolved ) {  // a NameOwnerChanged received meanwhile is newer
+    it->second.owner = owner;
+    it->second.resolved = true;
+  }
+  return it->second.owner;
+}
+
+std::string NameOwnerCache::senderRule( CStringView name ) {
+  std::string owner = resolve( name );
+  if ( owner.empty() )
+    return "sender='" + std::string { name.c_str() } + "'";
+  return "sender='" + owner + "'";
+}
+
+void NameOwnerCache::invalidate( CStringView name ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  auto it = names.find( name.c_str() );
+  if ( it != names.end() )
+    it->second.resolved = false;
+}
+
+void NameOwnerCache::clear() {
+  std::lock_guard<std::mutex> lock( mutex );
+  for ( auto &n : names )
+    n.second.resolved = false;
+}
+
+std::size_t NameOwnerCache::registerOwnerChanged( OwnerChangedCallback callback ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  callbacks.emplace( nextCallbackId, callback );
+  return nextCallbackId++;
+}
+
+void NameOwnerCache::unregisterOwnerChanged( std::size_t id ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  callbacks.erase( id );
+}
+
+void NameOwnerCache::ownerChanged( Reply &message ) {
+  std::string name, oldOwner, newOwner;
+  message.read( name );
+  message.read( oldOwner );
+  message.read( newOwner );
+
+  std::vector<OwnerChangedCallback> notify;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    auto it = names.find( name );
+    if ( it == names.end() )
+      return;
+    it->second.owner = newOwner;
+    it->second.resolved = true;
+    for ( auto &c : callbacks )
+      notify.push_back( c.second );
+  }
+
+  // outside the lock, callbacks are free to resolve() again
+  for ( auto &callback : notify )
+    callback( name, oldOwner, newOwner );
+}
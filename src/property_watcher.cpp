@@ -0,0 +1,107 @@
+#include "dbuscpp/property_watcher.h"
+#include "dbuscpp/signal_group.h"
+#include "internal.h"
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+PropertyWatcher::PropertyWatcher( CStringView service,
+  CStringView pathNamespace,
+  CStringView interface ) {
+  THROW_EXCEPTION_IF( *service.c_str() && !::sd_bus_service_name_is_valid( service.c_str() ),
+    "Invalid service name",
+    -EINVAL );
+  THROW_EXCEPTION_IF(
+    !::sd_bus_object_path_is_valid( pathNamespace.c_str() ), "Invalid object path", -EINVAL );
+  THROW_EXCEPTION_IF(
+    !::sd_bus_interface_name_is_valid( interface.c_str() ), "Invalid interface name", -EINVAL );
+
+  // valid names hold no quotes, nothing to escape
+  match = "type='signal',";
+  if ( *service.c_str() )
+    match += "sender='" + std::string { service.c_str() } + "',";
+  match += "interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',";
+  match += "path_namespace='" + std::string { pathNamespace.c_str() } + "',";
+  match += "arg0='" + std::string { interface.c_str() } + "'";
+}
+
+PropertyWatcher::~PropertyWatcher() {
+  stop();
+}
+
+void PropertyWatcher::onInvalidated(
+  std::function<void( const ObjectPath &, std::string_view property )> callback ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  auto next = std::make_shared<Handlers>( *handlers );
+  next->invalidated = callback;
+  handlers = std::move( next );
+}
+
+const std::string &PropertyWatcher::rule() const {
+  return match;
+}
+
+void PropertyWatcher::start() {
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( started )
+      return;
+    signal = SignalGroup::createSignal();
+    SignalGroup::matchRule( signal, match );
+    SignalGroup::signalMessageCallback(
+      signal, [this]( SignalID, Reply &message ) { changed( message ); } );
+    SignalGroup::add( signal );
+    started = true;
+  }
+  SignalGroup::start();
+}
+
+void PropertyWatcher::stop() {
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( !started )
+      return;
+    SignalGroup::remove( signal );
+    started = false;
+  }
+  SignalGroup::synchronize();  // a handler running meanwhile has returned
+}
+
+// PropertiesChanged( s interface, a{sv} changed, as invalidated ), the broker checked arg0
+void PropertyWatcher::changed( Reply &message ) {
+  ObjectPath object { message.path() };
+  std::string_view name;
+  std::shared_ptr<const Handlers> current;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    current = handlers;
+  }
+  auto &watched = current->changed;
+
+  message.skip( "s" );
+
+  message.enterContainer( DATA_TYPE::ARRAY, "{sv}" );
+  while ( message.enterContainerIf( DATA_TYPE::DICT_ENTRY, "sv" ) ) {
+    message.read( name );
+    auto it = watched.find( name );
+    if ( it != watched.end() &&
+         message.enterContainerIf( DATA_TYPE::VARIANT, it->second.signature ) ) {
+      it->second.changed( object, message );
+      message.exitContainer();
+    } else {
+      message.skip( "v" );
+    }
+    message.exitContainer();
+  }
+  message.exitContainer();
+
+  if ( !current->invalidated )
+    return;
+  message.enterContainer( DATA_TYPE::ARRAY, DATA_TYPE::STRING );
+  while ( !message.atEnd() ) {
+    message.read( name );
+    if ( watched.find( name ) != watched.end() )
+      current->invalidated( object, name );
+  }
+  message.exitContainer();
+}
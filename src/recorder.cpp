@@ -0,0 +1,426 @@
+#include "dbuscpp/recorder.h"
+#include "internal.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <systemd/sd-bus.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace dbus;
+
+namespace {
+const char MAGIC[8] = { 'D', 'B', 'U', 'S', 'R', 'E', 'C', 0 };
+const uint32_t VERSION = 1;
+const char END = 0;  // closes the innermost container of a body
+const std::size_t BUFFER_SIZE = 64 * 1024;
+
+std::size_t basicSize( char type ) {
+  switch ( type ) {
+    case 'y':
+      return 1;
+    case 'n':
+    case 'q':
+      return 2;
+    case 'b':
+    case 'i':
+    case 'u':
+      return 4;
+    case 'x':
+    case 't':
+    case 'd':
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+bool stringType( char type ) {
+  return type == 's' || type == 'o' || type == 'g';
+}
+
+bool containerType( char type ) {
+  return type == 'a' || type == 'r' || type == 'v' || type == 'e';
+}
+
+// uint32 length, the bytes and a terminating null
+void putString( std::string &out, const char *s ) {
+  uint32_t n = s ? static_cast<uint32_t>( std::strlen( s ) ) : 0;
+  out.append( reinterpret_cast<const char *>( &n ), sizeof( n ) );
+  out.append( s ? s : "", n );
+  out.push_back( '\0' );
+}
+
+bool getString( const uint8_t *&p, const uint8_t *end, std::string_view &s ) {
+  uint32_t n;
+  if ( end - p < static_cast<std::ptrdiff_t>( sizeof( n ) ) )
+    return false;
+  std::memcpy( &n, p, sizeof( n ) );
+  p += sizeof( n );
+  if ( static_cast<std::size_t>( end - p ) < std::size_t { n } + 1 || p[n] != '\0' )
+    return false;
+  s = std::string_view { reinterpret_cast<const char *>( p ), n };
+  p += n + 1;
+  return true;
+}
+
+// walks the message, basic values by type, containers as open token, contents and END
+bool encodeBody( sd_bus_message *m, std::string &out ) {
+  int depth = 0;
+  for ( ;; ) {
+    char type;
+    const char *contents;
+    int r = ::sd_bus_message_peek_type( m, &type, &contents );
+    if ( r < 0 )
+      return false;
+
+    if ( r == 0 ) {
+      if ( depth == 0 )
+        return true;
+      if ( ::sd_bus_message_exit_container( m ) < 0 )
+        return false;
+      out.push_back( END );
+      --depth;
+      continue;
+    }
+
+    if ( containerType( type ) ) {
+      if ( ::sd_bus_message_enter_container( m, type, contents ) < 0 )
+        return false;
+      out.push_back( type );
+      putString( out, contents );
+      ++depth;
+    } else if ( stringType( type ) ) {
+      const char *s;
+      if ( ::sd_bus_message_read_basic( m, type, &s ) < 0 )
+        return false;
+      out.push_back( type );
+      putString( out, s );
+    } else if ( basicSize( type ) ) {
+      uint64_t raw = 0;  // read_basic stores the value in the first bytes
+      if ( ::sd_bus_message_read_basic( m, type, &raw ) < 0 )
+        return false;
+      out.push_back( type );
+      out.append( reinterpret_cast<const char *>( &raw ), basicSize( type ) );
+    } else {
+      return false;  // unix fd
+    }
+  }
+}
+
+bool decodeBody( sd_bus_message *m, const uint8_t *p, std::size_t size ) {
+  const uint8_t *end = p + size;
+  std::string_view s;
+  while ( p < end ) {
+    char type = static_cast<char>( *p++ );
+    int r = 0;
+    if ( type == END ) {
+      r = ::sd_bus_message_close_container( m );
+    } else if ( containerType( type ) ) {
+      if ( !getString( p, end, s ) )
+        return false;
+      r = ::sd_bus_message_open_container( m, type, s.data() );
+    } else if ( stringType( type ) ) {
+      if ( !getString( p, end, s ) )
+        return false;
+      r = ::sd_bus_message_append_basic( m, type, s.data() );
+    } else if ( std::size_t n = basicSize( type ) ) {
+      uint64_t raw = 0;
+      if ( static_cast<std::size_t>( end - p ) < n )
+        return false;
+      std::memcpy( &raw, p, n );
+      p += n;
+      r = ::sd_bus_message_append_basic( m, type, &raw );
+    } else {
+      return false;
+    }
+    if ( r < 0 )
+      return false;
+  }
+  return true;
+}
+
+const char *orNull( std::string_view s ) {
+  return s.empty() ? nullptr : s.data();
+}
+}  // namespace
+
+Recorder::Recorder( CStringView file ) {
+  fd = ::open( file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644 );
+  THROW_EXCEPTION_IF( fd < 0, "Failed to open recording", errno );
+
+  buffer.append( MAGIC, sizeof( MAGIC ) );
+  buffer.append( reinterpret_cast<const char *>( &VERSION ), sizeof( VERSION ) );
+  buffer.append( 4, '\0' );
+  std::lock_guard<std::mutex> lock( mutex );
+  write();
+  if ( failure )
+    ::close( fd );
+  THROW_EXCEPTION_IF( failure != 0, "Failed to write recording", failure );
+}
+
+Recorder::~Recorder() {
+  try {
+    flush();
+  } catch ( ... ) {
+  }
+  ::close( fd );
+}
+
+uint64_t Recorder::now() {
+  return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() )
+                                  .count() );
+}
+
+void Recorder::record( void *message, int direction, uint64_t timestamp ) noexcept {
+  sd_bus_message *m = (sd_bus_message *)message;
+  try {
+    RecordHeader header {};
+    header.direction = static_cast<uint8_t>( direction );
+    header.timestamp = timestamp ? timestamp : now();
+    ::sd_bus_message_get_type( m, &header.type );
+    ::sd_bus_message_get_cookie( m, &header.cookie );
+    ::sd_bus_message_get_reply_cookie( m, &header.replyCookie );
+
+    std::string record( sizeof( header ), '\0' );
+    putString( record, ::sd_bus_message_get_destination( m ) );
+    putString( record, ::sd_bus_message_get_sender( m ) );
+    putString( record, ::sd_bus_message_get_path( m ) );
+    putString( record, ::sd_bus_message_get_interface( m ) );
+    putString( record, ::sd_bus_message_get_member( m ) );
+    putString( record, ::sd_bus_message_get_signature( m, 1 ) );
+
+    std::string body;
+    if ( ::sd_bus_message_rewind( m, 1 ) < 0 || !encodeBody( m, body ) ) {
+      header.flags |= RecordFlags::RECORD_NO_BODY;
+      body.clear();
+    }
+    ::sd_bus_message_rewind( m, 1 );  // whoever reads the message next starts at the top
+
+    uint32_t bodySize = static_cast<uint32_t>( body.size() );
+    record.append( reinterpret_cast<const char *>( &bodySize ), sizeof( bodySize ) );
+    record += body;
+    record.append( ( 8 - record.size() % 8 ) % 8, '\0' );
+    header.size = static_cast<uint32_t>( record.size() );
+    std::memcpy( &record[0], &header, sizeof( header ) );
+
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( failure ) {
+      ++lost;
+      return;
+    }
+    buffer += record;
+    ++count;
+    ++buffered;
+    if ( buffer.size() >= BUFFER_SIZE )
+      write();
+  } catch ( ... ) {  // out of memory
+    ::sd_bus_message_rewind( m, 1 );
+    std::lock_guard<std::mutex> lock( mutex );
+    ++lost;
+  }
+}
+
+void Recorder::flush() {
+  std::lock_guard<std::mutex> lock( mutex );
+  write();
+  THROW_EXCEPTION_IF( failure != 0, "Failed to write recording", failure );
+}
+
+uint64_t Recorder::records() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return count;
+}
+
+uint64_t Recorder::bytes() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return written + buffer.size();
+}
+
+uint64_t Recorder::dropped() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return lost;
+}
+
+int Recorder::error() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return failure;
+}
+
+// the recording ends at the first failure, a record cut short there ends it for readers
+void Recorder::write() noexcept {
+  std::size_t done = 0;
+  while ( !failure && done < buffer.size() ) {
+    ssize_t n = ::write( fd, buffer.data() + done, buffer.size() - done );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n < 0 )
+      failure = errno;
+    else
+      done += static_cast<std::size_t>( n );
+  }
+  written += done;
+  if ( failure ) {
+    count -= buffered;
+    lost += buffered;
+  }
+  buffered = 0;
+  buffer.clear();
+}
+
+Recording::Recording( CStringView file ) {
+  int fd = ::open( file.c_str(), O_RDONLY | O_CLOEXEC );
+  THROW_EXCEPTION_IF( fd < 0, "Failed to open recording", errno );
+
+  struct stat st;
+  if ( ::fstat( fd, &st ) < 0 ) {
+    int e = errno;
+    ::close( fd );
+    THROW_EXCEPTION_IF( true, "Failed to open recording", e );
+  }
+  std::size_t fileSize = static_cast<std::size_t>( st.st_size );
+  void *map = fileSize >= FIRST ? ::mmap( nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0 )
+                                : MAP_FAILED;
+  int e = errno;
+  ::close( fd );
+  THROW_EXCEPTION_IF( fileSize < FIRST, "Not a recording, the file is too short" );
+  THROW_EXCEPTION_IF( map == MAP_FAILED, "Failed to map recording", e );
+  data = static_cast<const uint8_t *>( map );
+  mapped = fileSize;
+  length = fileSize;
+
+  uint32_t version;
+  std::memcpy( &version, data + sizeof( MAGIC ), sizeof( version ) );
+  if ( std::memcmp( data, MAGIC, sizeof( MAGIC ) ) != 0 || version != VERSION ) {
+    ::munmap( const_cast<uint8_t *>( data ), mapped );
+    THROW_EXCEPTION_IF( true, "Not a recording or an unknown version" );
+  }
+
+  // records are complete or a crash cut the last one, count up to there
+  std::size_t offset = FIRST;
+  RecordView record;
+  while ( next( offset, record ) )
+    ++count;
+  length = offset;
+  ::madvise( const_cast<uint8_t *>( data ), mapped, MADV_SEQUENTIAL );
+}
+
+Recording::~Recording() {
+  if ( data )
+    ::munmap( const_cast<uint8_t *>( data ), mapped );
+}
+
+bool Recording::next( std::size_t &offset, RecordView &record ) const {
+  if ( length - offset < sizeof( RecordHeader ) )
+    return false;
+  const RecordHeader *header = reinterpret_cast<const RecordHeader *>( data + offset );
+  if ( header->size < sizeof( RecordHeader ) || header->size % 8 || header->size > length - offset )
+    return false;
+
+  const uint8_t *p = data + offset + sizeof( RecordHeader );
+  const uint8_t *end = data + offset + header->size;
+  uint32_t bodySize;
+  if ( !getString( p, end, record.destination ) || !getString( p, end, record.sender ) ||
+       !getString( p, end, record.path ) || !getString( p, end, record.interface ) ||
+       !getString( p, end, record.member ) || !getString( p, end, record.signature ) ||
+       end - p < static_cast<std::ptrdiff_t>( sizeof( bodySize ) ) )
+    return false;
+  std::memcpy( &bodySize, p, sizeof( bodySize ) );
+  p += sizeof( bodySize );
+  if ( static_cast<std::size_t>( end - p ) < bodySize )
+    return false;
+
+  record.header = header;
+  record.body = p;
+  record.bodySize = bodySize;
+  offset += header->size;
+  return true;
+}
+
+std::size_t Recording::size() const {
+  return count;
+}
+
+Replayer::Replayer( const Recording &recording, Connection &target )
+  : recording( recording ), target( target ) {}
+
+ReplayStats Replayer::run( double speed ) {
+  ReplayStats stats;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t first = 0;
+  std::size_t offset = Recording::FIRST;
+  RecordView record;
+
+  while ( recording.next( offset, record ) ) {
+    const RecordHeader &h = *record.header;
+    bool call = h.direction == RecordDirection::RECORD_SENT && h.type == SD_BUS_MESSAGE_METHOD_CALL;
+    bool signal = h.type == SD_BUS_MESSAGE_SIGNAL;
+    if ( !call && !signal )
+      continue;  // replies and errors are the target's business
+    if ( h.flags & RecordFlags::RECORD_NO_BODY ) {
+      ++stats.skipped;
+      continue;
+    }
+
+    if ( speed > 0 ) {
+      if ( !first )
+        first = h.timestamp;
+      // stamps are taken before the record is appended and can go back, those are due now
+      uint64_t elapsed = h.timestamp > first ? h.timestamp - first : 0;
+      auto due = std::chrono::nanoseconds {
+        static_cast<int64_t>( static_cast<double>( elapsed ) / speed ) };
+      std::this_thread::sleep_until( start + due );
+    }
+
+    BusLock lock( target );
+    sd_bus *bus = (sd_bus *)target.borrowBusObject();
+    sd_bus_message *m = nullptr;
+    int r = call ? ::sd_bus_message_new_method_call( bus,
+                     &m,
+                     orNull( record.destination ),
+                     record.path.data(),
+                     orNull( record.interface ),
+                     record.member.data() )
+                 : ::sd_bus_message_new_signal(
+                     bus, &m, record.path.data(), record.interface.data(), record.member.data() );
+    if ( r >= 0 && signal && !record.destination.empty() )
+      r = ::sd_bus_message_set_destination( m, record.destination.data() );
+    if ( r < 0 || !decodeBody( m, record.body, record.bodySize ) ) {
+      ::sd_bus_message_unref( m );
+      ++stats.errors;
+      continue;
+    }
+
+    if ( call ) {
+      ::sd_bus_error err = SD_BUS_ERROR_NULL;
+      sd_bus_message *reply = nullptr;
+      auto sent = std::chrono::steady_clock::now();
+      r = ::sd_bus_call( bus, m, 0, &err, &reply );
+      m_latency.record( static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() -
+                                                               sent )
+          .count() ) );
+      ::sd_bus_message_unref( reply );
+      ::sd_bus_error_free( &err );
+      ++stats.calls;
+    } else {
+      r = ::sd_bus_send( bus, m, nullptr );
+      ++stats.signals;
+    }
+    ::sd_bus_message_unref( m );
+    if ( r < 0 )
+      ++stats.errors;
+  }
+
+  BusLock lock( target );
+  ::sd_bus_flush( (sd_bus *)target.borrowBusObject() );
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+  return stats;
+}
+
+const LatencyHistogram &Replayer::latency() const {
+  return m_latency;
+}
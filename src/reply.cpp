@@ -1,8 +1,10 @@
 #include "dbuscpp/reply.h"
+#include "dbuscpp/type_tree.h"
 #include "internal.h"
 #include <iostream>
 #include <string>
 #include <systemd/sd-bus.h>
+#include <utility>
 
 using namespace dbus;
 
@@ -30,6 +32,19 @@ Reply &Reply::operator=( const Reply &rhs ) {
   return *this;
 }
 
+Reply::Reply( Reply &&other ) noexcept : msg { std::exchange( other.msg, nullptr ) } {}
+
+Reply &Reply::operator=( Reply &&rhs ) noexcept {
+  if ( this == &rhs )
+    return *this;
+  std::lock_guard<std::mutex> lock( mutex );
+
+  if ( msg )
+    msg = ::sd_bus_message_unref( (sd_bus_message *)msg );
+  msg = std::exchange( rhs.msg, nullptr );
+  return *this;
+}
+
 Reply::~Reply() {
   msg = ::sd_bus_message_unref( (sd_bus_message *)msg );
 }
@@ -47,43 +62,29 @@ int Reply::type() {
   return msg_type;
 }
 
-bool Reply::signatureValid( std::string signature ) {
-  // TODO make this check smarter
-  bool is_valid = false;
-  for ( const char c : signature ) {
-    if ( c == static_cast<char>( DATA_TYPE::BYTE ) ||
-         c == static_cast<char>( DATA_TYPE::BOOLEAN ) ||
-         c == static_cast<char>( DATA_TYPE::INT16 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT16 ) ||
-         c == static_cast<char>( DATA_TYPE::INT32 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT32 ) ||
-         c == static_cast<char>( DATA_TYPE::INT64 ) ||
-         c == static_cast<char>( DATA_TYPE::UINT64 ) ||
-         c == static_cast<char>( DATA_TYPE::DOUBLE ) ||
-         c == static_cast<char>( DATA_TYPE::STRING ) ||
-         c == static_cast<char>( DATA_TYPE::OBJECT_PATH ) ||
-         c == static_cast<char>( DATA_TYPE::SIGNATURE ) ||
-         c == static_cast<char>( DATA_TYPE::UNIX_FD ) ||
-         c == static_cast<char>( DATA_TYPE::ARRAY ) ||
-         c == static_cast<char>( DATA_TYPE::VARIANT ) ||
-         c == static_cast<char>( DATA_TYPE::STRUCT_BEGIN ) ||
-         c == static_cast<char>( DATA_TYPE::STRUCT_END ) ||
-         c == static_cast<char>( DATA_TYPE::DICT_ENTRY_BEGIN ) ||
-         c == static_cast<char>( DATA_TYPE::DICT_ENTRY_END ) )
-      is_valid = true;
-    else
-      return false;  // no point of continuing the loop
-  }
-  return is_valid;
+bool Reply::signatureValid( std::string_view signature ) {
+  return validSignature( signature );
 }
 
-bool Reply::hasSignature( std::string signature ) {
+bool Reply::hasSignature( CStringView signature ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_has_signature(
     (sd_bus_message *)msg, signature.c_str() );  // returns 1 if match
   return r == 1;
 }
 
+std::string Reply::signature() {
+  std::lock_guard<std::mutex> lock( mutex );
+  const char *sig = ::sd_bus_message_get_signature( (sd_bus_message *)msg, 1 );
+  if ( sig )
+    return std::string { sig };
+  return std::string {};
+}
+
+std::shared_ptr<const TypeTree> Reply::typeTree() {
+  return dbus::typeTree( signature() );
+}
+
 char Reply::signatureType() {
   char sig_type = static_cast<char>( DATA_TYPE::EMPTY );
   const char *sig_contents;
@@ -109,14 +110,13 @@ std::string Reply::signatureContents() {
 }
 
 void Reply::enterContainer( char type, char content ) {
-  std::string contents = { content };
+  const char contents[] = { content, '\0' };
   enterContainer( type, contents );
 }
 
-void Reply::enterContainer( char type, std::string contents ) {
+void Reply::enterContainer( char type, CStringView contents ) {
   std::lock_guard<std::mutex> lock( mutex );
-  int r = ::sd_bus_message_enter_container( (sd_bus_message *)msg, type, contents.c_str() );
-  THROW_EXCEPTION_IF( r <= 0, "Failed to enter container", -r );
+  enter( type, contents.c_str() );
 }
 
 void Reply::enterContainer() {
@@ -125,13 +125,13 @@ void Reply::enterContainer() {
   enterContainer( type, contents.c_str() );
 }
 
-bool Reply::enterContainerIf( char type, std::string contents ) {
+bool Reply::enterContainerIf( char type, CStringView contents ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_enter_container( (sd_bus_message *)msg, type, contents.c_str() );
   return r > 0;
 }
 
-void Reply::skip( std::string types ) {
+void Reply::skip( CStringView types ) {
   std::lock_guard<std::mutex> lock( mutex );
   int r = ::sd_bus_message_skip( (sd_bus_message *)msg, types.c_str() );
 
@@ -139,8 +139,18 @@ void Reply::skip( std::string types ) {
 }
 void Reply::exitContainer() {
   std::lock_guard<std::mutex> lock( mutex );
-  int r = ::sd_bus_message_exit_container( (sd_bus_message *)msg );
-  THROW_EXCEPTION_IF( r < 0, "Failed to exit container", -r );
+  exit();
+}
+
+void Reply::rewind() {
+  std::lock_guard<std::mutex> lock( mutex );
+  int r = ::sd_bus_message_rewind( (sd_bus_message *)msg, 1 );
+  THROW_EXCEPTION_IF( r < 0, "Failed to rewind message", -r );
+}
+
+bool Reply::atEnd() {
+  std::lock_guard<std::mutex> lock( mutex );
+  return end();
 }
 
 std::string Reply::sender() {
@@ -246,7 +256,17 @@ void Reply::read( std::string &value ) {
 
   THROW_EXCEPTION_IF( r < 0, "Failed to read message value", -r );
 
-  value = std::string( p );
+  value.assign( p );
+}
+
+void Reply::read( std::string_view &value ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  char *p;
+  int r = ::sd_bus_message_read_basic( (sd_bus_message *)msg, SD_BUS_TYPE_STRING, &p );
+
+  THROW_EXCEPTION_IF( r < 0, "Failed to read message value", -r );
+
+  value = std::string_view { p };
 }
 
 void Reply::read( ObjectPath &value ) {
@@ -256,7 +276,7 @@ void Reply::read( ObjectPath &value ) {
 
   THROW_EXCEPTION_IF( r < 0, "Failed to read message value", -r );
 
-  value = std::string( p );
+  value.assign( p );
 }
 
 void Reply::read( std::vector<ObjectPath> &value ) {
@@ -302,6 +322,134 @@ void Reply::read( std::vector<std::byte> &value ) {
   ::sd_bus_message_exit_container( (sd_bus_message *)msg );
 }
 
+void Reply::extract( char type, void *value ) {
+  int r = ::sd_bus_message_read_basic( (sd_bus_message *)msg, type, value );
+  THROW_EXCEPTION_IF( r <= 0, "Failed to read message value", -r );
+}
+
+void Reply::enter( char type, const char *contents ) {
+  int r = ::sd_bus_message_enter_container( (sd_bus_message *)msg, type, contents );
+  THROW_EXCEPTION_IF( r <= 0, "Failed to enter container", -r );
+}
+
+void Reply::exit() {
+  int r = ::sd_bus_message_exit_container( (sd_bus_message *)msg );
+  THROW_EXCEPTION_IF( r < 0, "Failed to exit container", -r );
+}
+
+bool Reply::end() {
+  int r = ::sd_bus_message_at_end( (sd_bus_message *)msg, 0 );
+  THROW_EXCEPTION_IF( r < 0, "Failed to check end of container", -r );
+  return r > 0;
+}
+
+void Reply::read( const TypeTree &tree, const TypeVisitor &visitor ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  for ( auto &node : tree.types )
+    walk( node, visitor );
+}
+
+// one node of the tree, the mutex must be held
+void Reply::walk( const TypeNode &node, const TypeVisitor &visitor ) {
+  sd_bus_message *m = (sd_bus_message *)msg;
+
+  if ( !node.basic() ) {
+    if ( !visitor( node, nullptr ) ) {
+      int r = ::sd_bus_message_skip( m, node.signature.c_str() );
+      THROW_EXCEPTION_IF( r < 0, "Failed to skip message value", -r );
+      return;
+    }
+
+    if ( node.type == DATA_TYPE::VARIANT ) {
+      const char *contents = nullptr;
+      int r = ::sd_bus_message_peek_type( m, nullptr, &contents );
+      THROW_EXCEPTION_IF( r <= 0 || !contents, "Failed to read variant type", -EBADMSG );
+      std::shared_ptr<const TypeTree> inner = dbus::typeTree( contents );
+      enter( DATA_TYPE::VARIANT, contents );
+      for ( auto &child : inner->types )
+        walk( child, visitor );
+      exit();
+      return;
+    }
+
+    enter( node.type, node.contents.c_str() );
+    if ( node.type == DATA_TYPE::ARRAY )
+      while ( !end() )
+        walk( node.children.front(), visitor );
+    else
+      for ( auto &child : node.children )
+        walk( child, visitor );
+    exit();
+    return;
+  }
+
+  BasicValue value;
+  switch ( node.type ) {
+    case DATA_TYPE::BOOLEAN: {
+      int b;  // sd-bus reads booleans as int
+      extract( node.type, &b );
+      value = b != 0;
+      break;
+    }
+    case DATA_TYPE::BYTE: {
+      uint8_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::INT16: {
+      int16_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::UINT16: {
+      uint16_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::INT32:
+    case DATA_TYPE::UNIX_FD: {
+      int32_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::UINT32: {
+      uint32_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::INT64: {
+      int64_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::UINT64: {
+      uint64_t v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    case DATA_TYPE::DOUBLE: {
+      double v;
+      extract( node.type, &v );
+      value = v;
+      break;
+    }
+    default: {  // string, object path, signature
+      const char *v = nullptr;
+      extract( node.type, &v );
+      value = std::string_view { v };
+      break;
+    }
+  }
+  visitor( node, &value );
+}
+
 void *Reply::borrowBusMessage() {
   THROW_EXCEPTION_IF( !msg, "Attempt to aqcuire a null message pointer" );
   return msg;
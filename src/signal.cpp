@@ -1,20 +1,49 @@
 #include "dbuscpp/signal.h"
 #include "systemd/sd-bus.h"
+#include <atomic>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <utility>
 
 using namespace dbus;
 
-Signal::Signal() {
+SignalID SignalID::next( uint32_t index ) {
+  static std::atomic<uint32_t> counter { 0 };
+  uint32_t generation = 0;
+  while ( generation == 0 )  // 0 marks an invalid handle, skipped on wrap-around
+    generation = counter.fetch_add( 1, std::memory_order_relaxed ) + 1;
+  return SignalID { index, generation };
+}
+
+// one random UUID per process, its second half replaced with the handle
+boost::uuids::uuid SignalID::uuid() const {
+  static const boost::uuids::uuid base = boost::uuids::random_generator()();
+  boost::uuids::uuid u = base;
+  std::memcpy( u.data + 8, &m_value, sizeof( m_value ) );
+  return u;
+}
+
+std::ostream& dbus::operator<<( std::ostream& os, const SignalID& id ) {
+  std::ios_base::fmtflags flags = os.flags();
+  os << std::hex << std::setw( 16 ) << std::setfill( '0' ) << id.value();
+  os.flags( flags );
+  return os;
+}
+
+Signal::Signal() : m_uuid( SignalID::next() ), m_latency( std::make_shared<SignalLatency>() ) {
   m_rule = std::string {};
-  m_uuid = boost::uuids::random_generator()();
   m_slot = nullptr;
 }
 
-Signal::Signal( std::string rule, std::function<void( SignalID )> callback ) {
+Signal::Signal( SignalID id ) : m_uuid( id ), m_latency( std::make_shared<SignalLatency>() ) {}
+
+Signal::Signal( std::string rule, std::function<void( SignalID )> callback )
+  : m_uuid( SignalID::next() ), m_latency( std::make_shared<SignalLatency>() ) {
   m_rule = rule;
   m_callback = callback;
-  m_uuid = boost::uuids::random_generator()();
   m_slot = nullptr;
 }
 
@@ -28,10 +57,22 @@ Signal::Signal( const Signal& other ) {
   m_status = other.m_status;
   m_rule = other.m_rule;
   m_callback = other.m_callback;
+  m_messageCallback = other.m_messageCallback;
   m_statusCallback = other.m_statusCallback;
+  m_latency = other.m_latency;
   m_uuid = other.m_uuid;
 }
 
+Signal::Signal( Signal&& other ) noexcept
+  : m_uuid( other.m_uuid ),
+    m_slot( std::exchange( other.m_slot, nullptr ) ),
+    m_status( other.m_status ),
+    m_rule( std::move( other.m_rule ) ),
+    m_callback( std::move( other.m_callback ) ),
+    m_messageCallback( std::move( other.m_messageCallback ) ),
+    m_statusCallback( std::move( other.m_statusCallback ) ),
+    m_latency( std::move( other.m_latency ) ) {}
+
 Signal& Signal::operator=( const Signal& rhs ) {
   if ( m_slot )
     m_slot = ::sd_bus_slot_unref( (sd_bus_slot*)m_slot );
@@ -40,7 +81,25 @@ Signal& Signal::operator=( const Signal& rhs ) {
   m_status = rhs.m_status;
   m_rule = rhs.m_rule;
   m_callback = rhs.m_callback;
+  m_messageCallback = rhs.m_messageCallback;
   m_statusCallback = rhs.m_statusCallback;
+  m_latency = rhs.m_latency;
+  m_uuid = rhs.m_uuid;
+  return *this;
+}
+
+Signal& Signal::operator=( Signal&& rhs ) noexcept {
+  if ( this == &rhs )
+    return *this;
+  if ( m_slot )
+    m_slot = ::sd_bus_slot_unref( (sd_bus_slot*)m_slot );
+  m_slot = std::exchange( rhs.m_slot, nullptr );
+  m_status = rhs.m_status;
+  m_rule = std::move( rhs.m_rule );
+  m_callback = std::move( rhs.m_callback );
+  m_messageCallback = std::move( rhs.m_messageCallback );
+  m_statusCallback = std::move( rhs.m_statusCallback );
+  m_latency = std::move( rhs.m_latency );
   m_uuid = rhs.m_uuid;
   return *this;
 }
@@ -61,11 +120,27 @@ void Signal::callback() {
     m_callback( m_uuid );
 }
 
+void Signal::callback( Reply& message ) {
+  auto start = std::chrono::steady_clock::now();
+  if ( m_callback )
+    m_callback( m_uuid );
+  if ( m_messageCallback )
+    m_messageCallback( m_uuid, message );
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start );
+  if ( m_latency )
+    m_latency->callback.record( static_cast<uint64_t>( elapsed.count() ) );
+}
+
 void Signal::registerCallback( std::function<void( SignalID )> cb ) {
   m_callback = cb;
 }
 
-boost::uuids::uuid Signal::uuid() {
+void Signal::registerMessageCallback( SignalMessageCallback cb ) {
+  m_messageCallback = cb;
+}
+
+SignalID Signal::uuid() {
   return m_uuid;
 }
 
@@ -102,3 +177,7 @@ void* Signal::slot() {
 void Signal::updateSlot( void* other ) {
   m_slot = other;
 }
+
+std::shared_ptr<SignalLatency> Signal::latency() {
+  return m_latency;
+}
@@ -0,0 +1,168 @@
+#include "dbuscpp/signal_emitter.h"
+#include "dbuscpp/recorder.h"
+#include "internal.h"
+#include <mutex>
+#include <systemd/sd-bus.h>
+
+using namespace dbus;
+
+PreparedSignal::PreparedSignal( CStringView object, CStringView interface, CStringView member ) {
+  THROW_EXCEPTION_IF(
+    !::sd_bus_object_path_is_valid( object.c_str() ), "Invalid object path", -EINVAL );
+  THROW_EXCEPTION_IF(
+    !::sd_bus_interface_name_is_valid( interface.c_str() ), "Invalid interface name", -EINVAL );
+  THROW_EXCEPTION_IF(
+    !::sd_bus_member_name_is_valid( member.c_str() ), "Invalid member name", -EINVAL );
+
+  m_object = intern( object.c_str() );
+  m_interface = intern( interface.c_str() );
+  m_member = intern( member.c_str() );
+}
+
+const char *PreparedSignal::path() const {
+  return m_object->c_str();
+}
+
+const char *PreparedSignal::interface() const {
+  return m_interface->c_str();
+}
+
+const char *PreparedSignal::member() const {
+  return m_member->c_str();
+}
+
+SignalEmitter::SignalEmitter( int connectionType ) : conn( connectionType ) {}
+
+SignalEmitter::~SignalEmitter() {
+  try {
+    flush();
+  } catch ( ... ) {
+  }
+}
+
+Connection &SignalEmitter::connection() {
+  return conn;
+}
+
+Message SignalEmitter::signal( const PreparedSignal &header ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  BusLock busLock( conn );
+
+  sd_bus_message *msg = nullptr;
+  int r = ::sd_bus_message_new_signal( (sd_bus *)conn.borrowBusObject(),
+    &msg,
+    header.path(),
+    header.interface(),
+    header.member() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to create new signal message", -r );
+
+  return Message { msg };
+}
+
+void SignalEmitter::emit( const Message &m ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  BusLock busLock( conn );
+  send( m );
+
+  // sd-bus only writes directly while its queue is empty, whatever an earlier emit left
+  // behind is written here. Processing would read and drop messages nobody dispatches.
+  if ( conn.queuedMessages() > 0 ) {
+    int r = ::sd_bus_flush( (sd_bus *)conn.borrowBusObject() );
+    THROW_EXCEPTION_IF( r < 0, "Failed to flush bus", -r );
+  }
+}
+
+void SignalEmitter::emit( const std::vector<Message> &messages ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  BusLock busLock( conn );
+  for ( auto &m : messages )
+    send( m );
+
+  int r = ::sd_bus_flush( (sd_bus *)conn.borrowBusObject() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to flush bus", -r );
+}
+
+void SignalEmitter::flush() {
+  std::lock_guard<std::mutex> lock( mutex );
+  BusLock busLock( conn );
+  int r = ::sd_bus_flush( (sd_bus *)conn.borrowBusObject() );
+  THROW_EXCEPTION_IF( r < 0, "Failed to flush bus", -r );
+}
+
+void SignalEmitter::history( std::size_t depth ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  this->depth = depth;
+  if ( !depth ) {
+    kept.clear();
+    return;
+  }
+  for ( auto &k : kept )
+    while ( k.second.size() > depth )
+      k.second.pop_front();
+}
+
+std::vector<Message> SignalEmitter::last( CStringView object ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  auto it = kept.find( object.c_str() );
+  if ( it == kept.end() )
+    return {};
+  return std::vector<Message> { it->second.begin(), it->second.end() };
+}
+
+std::size_t SignalEmitter::replay( CStringView object, CStringView destination ) {
+  std::lock_guard<std::mutex> lock( mutex );
+  BusLock busLock( conn );
+  auto it = kept.find( object.c_str() );
+  if ( it == kept.end() )
+    return 0;
+
+  sd_bus *bus = (sd_bus *)conn.borrowBusObject();
+  std::size_t sent = 0;
+
+  // a sent message is sealed, each one is copied into a new, unicast signal
+  for ( auto &m : it->second ) {
+    sd_bus_message *source = (sd_bus_message *)m.borrowBusMessage();
+    sd_bus_message *msg = nullptr;
+
+    int r = ::sd_bus_message_new_signal( bus,
+      &msg,
+      ::sd_bus_message_get_path( source ),
+      ::sd_bus_message_get_interface( source ),
+      ::sd_bus_message_get_member( source ) );
+    THROW_EXCEPTION_IF( r < 0, "Failed to create new signal message", -r );
+    Message copy { msg };
+
+    if ( ( r = ::sd_bus_message_set_destination( msg, destination.c_str() ) ) >= 0 &&
+         ( r = ::sd_bus_message_rewind( source, 1 ) ) >= 0 )
+      r = ::sd_bus_message_copy( msg, source, 1 );
+    THROW_EXCEPTION_IF( r < 0, "Failed to copy signal message", -r );
+
+    conn.admit( m.size() );
+    r = ::sd_bus_send( bus, msg, nullptr );
+    THROW_EXCEPTION_IF( r < 0, "Failed to send signal", -r );
+    conn.sent( m.size() );
+    conn.trace( msg, RecordDirection::RECORD_SENT );
+    ++sent;
+  }
+
+  int r = ::sd_bus_flush( bus );
+  THROW_EXCEPTION_IF( r < 0, "Failed to flush bus", -r );
+  return sent;
+}
+
+void SignalEmitter::send( const Message &m ) {
+  conn.admit( m.size() );
+  int r = ::sd_bus_send(
+    (sd_bus *)conn.borrowBusObject(), (sd_bus_message *)m.borrowBusMessage(), nullptr );
+  THROW_EXCEPTION_IF( r < 0, "Failed to send signal", -r );
+  conn.sent( m.size() );
+  conn.trace( m.borrowBusMessage(), RecordDirection::RECORD_SENT );
+
+  if ( !depth )
+    return;
+  const char *path = ::sd_bus_message_get_path( (sd_bus_message *)m.borrowBusMessage() );
+  auto &ring = kept[path ? path : ""];
+  ring.push_back( m );
+  if ( ring.size() > depth )
+    ring.pop_front();
+}
@@ -1,10 +1,18 @@
 #include "dbuscpp/signal_group.h"
 #include "dbuscpp/reply.h"
 #include "internal.h"
+#include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 #include <sys/poll.h>
 #include <systemd/sd-bus.h>
+#include <thread>
 
 namespace dbus {
 int match_callback( sd_bus_message *msg, void *userdata, sd_bus_error *error ) {
@@ -13,12 +21,26 @@ int match_callback( sd_bus_message *msg, void *userdata, sd_bus_error *error ) {
     Signal *s = static_cast<Signal *>( userdata );
     // check status in case the signal was removed after the callback was triggered
     if ( s->status() == SignalStatus::ADDED ) {
-      s->callback();
+      // not run here, sd_bus_process holds the bus lock that Manager calls wait for
+      SignalGroupImp::get().defer( s->uuid(), msg );
     }
     return 0;
   }
   return -1;
 }
+
+// reply to the AddMatch sent by sd_bus_add_match_async
+int install_callback( sd_bus_message *msg, void *userdata, sd_bus_error *error ) {
+  std::ignore = error;
+  Signal *s = static_cast<Signal *>( userdata );
+  if ( !s || !msg )
+    return 0;
+  bool failed = ::sd_bus_message_is_method_error( msg, nullptr );
+  if ( failed && s->status() == SignalStatus::ADDED )
+    s->updateStatus( SignalStatus::MATCH_FAILED );
+  SignalGroupImp::get().acknowledge( s->uuid(), !failed );
+  return 0;
+}
 }  // namespace dbus
 
 using namespace dbus;
@@ -29,91 +51,207 @@ SignalGroupImp::~SignalGroupImp() {
   stop();
   // unref the match slots, which ends the match
   for ( auto &s : signals ) {
-    void *slot = s.slot();
+    if ( !s )
+      continue;
+    void *slot = s->slot();
     if ( slot ) {
       slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
-      s.updateSlot( slot );
+      s->updateSlot( slot );
     }
-    signals.erase( signals.begin(), signals.end() );
   }
+  signals.clear();
 }
 
-SignalID SignalGroupImp::createSignal() {
-  Signal sig;
+Signal *SignalGroupImp::find( SignalID uuid ) {
+  uint32_t index = uuid.index();
+  if ( index >= signals.size() || !signals[index] || signals[index]->uuid() != uuid )
+    return nullptr;
+  return signals[index].get();
+}
 
-  sig.updateSlot( nullptr );
-  sig.updateStatus( SignalStatus::UNDEFINED );
+SignalID SignalGroupImp::createSignal() {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
 
-  auto uuid = sig.uuid();
+  uint32_t index = 0;
+  if ( !freeSlots.empty() ) {
+    index = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    index = static_cast<uint32_t>( signals.size() );
+    signals.emplace_back();
+  }
 
-  std::lock_guard<std::mutex> lock( mutex );
-  signals.push_back( std::move( sig ) );
+  SignalID uuid = SignalID::next( index );
+  signals[index] = std::make_unique<Signal>( uuid );
+  signals[index]->updateSlot( nullptr );
+  signals[index]->updateStatus( SignalStatus::UNDEFINED );
+  ++count;
 
   return uuid;
 }
 
 bool SignalGroupImp::matchRule( SignalID uuid, std::string rule ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid ) {
-      s.updateRule( rule );
-      return true;
-    }
-  return false;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( s )
+    s->updateRule( rule );
+  return s != nullptr;
 }
 
 bool SignalGroupImp::signalCallback( SignalID uuid, std::function<void( SignalID )> callback ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid ) {
-      s.registerCallback( callback );
-      return true;
-    }
-  return false;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( s )
+    s->registerCallback( callback );
+  return s != nullptr;
 }
 
 bool SignalGroupImp::signalStatusCallback( SignalID uuid,
   std::function<void( SignalID )> callback ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid ) {
-      s.registerStatusCallback( callback );
-      return true;
-    }
-  return false;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( s )
+    s->registerStatusCallback( callback );
+  return s != nullptr;
+}
+
+bool SignalGroupImp::signalMessageCallback( SignalID uuid, SignalMessageCallback callback ) {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( s )
+    s->registerMessageCallback( callback );
+  return s != nullptr;
+}
+
+std::shared_ptr<SignalLatency> SignalGroupImp::latency( SignalID uuid ) {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  return s ? s->latency() : nullptr;
 }
 
 bool SignalGroupImp::add( SignalID uuid ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid ) {
-      if ( s.status() != SignalStatus::ADDED ) {
-        s.updateStatus( SignalStatus::ADD_REQUEST );
-        signalChanged = true;
-      }
-      return true;
-    }
-  return false;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( !s )
+    return false;
+  if ( s->status() != SignalStatus::ADDED ) {
+    s->updateStatus( SignalStatus::ADD_REQUEST );
+    signalChanged = true;
+  }
+  return true;
 }
 
 bool SignalGroupImp::contains( SignalID uuid ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid )
-      return true;
-  return false;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  return find( uuid ) != nullptr;
 }
 
 void SignalGroupImp::remove( SignalID uuid ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid ) {
-      s.updateStatus( SignalStatus::REMOVE_REQUEST );
-      signalChanged = true;
-      break;
-    }
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  if ( s ) {
+    s->updateStatus( SignalStatus::REMOVE_REQUEST );
+    signalChanged = true;
+  }
+}
+
+void SignalGroupImp::synchronize() {
+  if ( std::this_thread::get_id() == loopId.load() )
+    return;  // no other callback runs meanwhile
+  // a removed signal fails the status check made under this lock
+  std::lock_guard<std::mutex> lock( callbackMutex );
+}
+
+bool SignalGroupImp::installed( SignalID uuid, std::chrono::milliseconds timeout ) {
+  if ( std::this_thread::get_id() == loopId.load() )
+    return false;  // the loop cannot take the reply off the bus while it waits here
+
+  std::unique_lock<std::mutex> lock( installMutex );
+  if ( !installChanged.wait_for(
+         lock, timeout, [&]() { return acknowledged.find( uuid ) != acknowledged.end(); } ) )
+    return false;
+  return acknowledged[uuid];
+}
+
+// records the broker's answer to a match, or forgets a removed one
+void SignalGroupImp::acknowledge( SignalID uuid, bool ok, bool forget ) {
+  {
+    std::lock_guard<std::mutex> lock( installMutex );
+    if ( forget )
+      acknowledged.erase( uuid );
+    else
+      acknowledged[uuid] = ok;
+  }
+  installChanged.notify_all();
 }
 
 void SignalGroupImp::start() {
-  if ( !loopRunning && !stopRequest ) {
-    std::lock_guard<std::mutex> lock( mutex );
+  if ( loopRunning || stopRequest )
+    return;
+
+  std::exception_ptr failure;
+  {
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    if ( loopThread.joinable() )
+      loopThread.join();  // ended on its own when its bus went away
     stopRequest = false;
     loopThread = std::thread { &SignalGroupImp::eventLoop, this };
     loopRunning = true;
+    try {
+      tune();
+      return;
+    } catch ( ... ) {
+      failure = std::current_exception();
+    }
+  }
+
+  // a loop the caller was told failed must not keep running; it takes the mutex while
+  // it runs, so it is joined after the lock is released
+  stop();
+  std::rethrow_exception( failure );
+}
+
+void SignalGroupImp::configure( const LoopConfig &config ) {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  loopConfig = config;
+  busyPollUsec = config.busyPoll.count();
+  if ( loopThread.joinable() )
+    tune();
+}
+
+void SignalGroupImp::useConnection( const Connection &c ) {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  loopConnection = std::make_unique<Connection>( c );
+}
+
+void SignalGroupImp::resetConnection() {
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  loopConnection.reset();
+}
+
+// applies the thread settings of the loop configuration, mutex must be held
+void SignalGroupImp::tune() {
+  pthread_t thread = loopThread.native_handle();
+  int r = 0;
+
+  if ( !loopConfig.name.empty() ) {
+    r = ::pthread_setname_np( thread, loopConfig.name.substr( 0, 15 ).c_str() );
+    THROW_EXCEPTION_IF( r != 0, "Failed to name the signal loop thread", r );
+  }
+
+  if ( loopConfig.cpu >= 0 ) {
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    CPU_SET( loopConfig.cpu, &cpus );
+    r = ::pthread_setaffinity_np( thread, sizeof( cpus ), &cpus );
+    THROW_EXCEPTION_IF( r != 0, "Failed to set the signal loop CPU affinity", r );
+  }
+
+  if ( loopConfig.priority > 0 ) {
+    sched_param param {};
+    param.sched_priority = loopConfig.priority;
+    r = ::pthread_setschedparam( thread, SCHED_FIFO, &param );
+    THROW_EXCEPTION_IF( r != 0, "Failed to set the signal loop SCHED_FIFO priority", r );
   }
 }
 
@@ -125,10 +263,9 @@ void SignalGroupImp::stop() {
 }
 
 SignalStatus SignalGroupImp::status( SignalID uuid ) {
-  for ( auto &s : signals )
-    if ( s.uuid() == uuid )
-      return s.status();
-  return SignalStatus::UNDEFINED;
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  Signal *s = find( uuid );
+  return s ? s->status() : SignalStatus::UNDEFINED;
 }
 
 GroupStatus SignalGroupImp::status() {
@@ -142,69 +279,264 @@ GroupStatus SignalGroupImp::status() {
 }
 
 std::size_t SignalGroupImp::size() {
-  return signals.size();
+  std::lock_guard<std::recursive_mutex> lock( mutex );
+  return count;
+}
+
+std::size_t SignalGroupImp::registerReconnect( ReconnectCallback callback ) {
+  std::lock_guard<std::mutex> lock( reconnectMutex );
+  reconnectCallbacks.emplace( nextReconnectId, callback );
+  return nextReconnectId++;
+}
+
+void SignalGroupImp::unregisterReconnect( std::size_t id ) {
+  std::lock_guard<std::mutex> lock( reconnectMutex );
+  reconnectCallbacks.erase( id );
+}
+
+uint64_t SignalGroupImp::reconnects() {
+  return reconnectCount;
+}
+
+void SignalGroupImp::defer( SignalID uuid, void *message ) {
+  bool first = false;
+  {
+    std::lock_guard<std::mutex> lock( deliveryMutex );
+    first = deliveries.empty();
+    deliveries.push_back( { uuid,
+      Reply { ::sd_bus_message_ref( (sd_bus_message *)message ) },
+      std::chrono::steady_clock::now() } );
+  }
+  // dispatched by a Manager on the shared bus, the loop may be sleeping in poll
+  int fd = wakeFd;
+  if ( first && fd >= 0 && std::this_thread::get_id() != loopId.load() )
+    ::eventfd_write( fd, 1 );
+}
+
+// runs the callbacks of the deferred signals, without the bus lock so a callback may
+// call a Manager on the same bus
+void SignalGroupImp::deliver( Connection &c ) {
+  std::vector<Delivery> batch;
+  {
+    std::lock_guard<std::mutex> lock( deliveryMutex );
+    batch.swap( deliveries );
+  }
+  if ( batch.empty() )
+    return;
+
+  for ( auto &d : batch ) {
+    Signal *s = nullptr;
+    {
+      std::lock_guard<std::recursive_mutex> lock( mutex );
+      s = find( d.uuid );
+    }
+    // only install() frees a signal and it runs on this thread
+    std::lock_guard<std::mutex> lock( callbackMutex );
+    if ( s && s->status() == SignalStatus::ADDED ) {
+      auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - d.received );
+      s->latency()->queue.record( static_cast<uint64_t>( waited.count() ) );
+      s->callback( d.message );
+    }
+  }
+
+  // the messages reference the bus, whose reference count is not atomic
+  BusLock busLock { c, false };
+  batch.clear();
+}
+
+// sends AddMatch for every requested signal without waiting for the replies,
+// so thousands of matches cost one round trip instead of one each
+void SignalGroupImp::install( void *bus ) {
+  signalChanged = false;
+
+  for ( uint32_t i = 0; i < signals.size(); ++i ) {
+    Signal *s = signals[i].get();
+    if ( !s )
+      continue;
+
+    if ( s->status() == SignalStatus::REMOVE_REQUEST ) {
+      void *slot = s->slot();
+      slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
+      s->updateSlot( slot );
+      s->updateStatus( SignalStatus::REMOVED );
+      acknowledge( s->uuid(), false, true );
+      signals[i].reset();
+      freeSlots.push_back( i );
+      --count;
+      continue;
+    }
+
+    if ( s->status() == SignalStatus::ADD_REQUEST ) {
+      std::string rule = s->rule();
+      void *slot = nullptr;
+      int r = ::sd_bus_add_match_async( (sd_bus *)bus,
+        (sd_bus_slot **)&slot,
+        rule.c_str(),
+        match_callback,
+        install_callback,
+        s );
+      if ( r < 0 ) {
+        s->updateStatus( SignalStatus::MATCH_FAILED );
+        acknowledge( s->uuid(), false );
+      } else {
+        s->updateSlot( slot );
+        s->updateStatus( SignalStatus::ADDED );  // MATCH_FAILED later if the broker refuses
+      }
+    }
+  }
+}
+
+// reopens the bus after the broker went away, backing off between attempts,
+// returns false when the loop was asked to stop meanwhile
+bool SignalGroupImp::reconnect( Connection &c, std::chrono::milliseconds &backoff ) {
+  std::chrono::milliseconds reconnectMax;
+  {
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    BusLock busLock { c, false };
+    // the matches died with the old bus
+    for ( auto &s : signals ) {
+      if ( !s )
+        continue;
+      void *slot = s->slot();
+      if ( slot ) {
+        slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
+        s->updateSlot( slot );
+      }
+      if ( s->status() == SignalStatus::ADDED )
+        s->updateStatus( SignalStatus::ADD_REQUEST );
+    }
+    {
+      std::lock_guard<std::mutex> deliveryLock( deliveryMutex );
+      deliveries.clear();  // held on to the old bus
+    }
+    {
+      std::lock_guard<std::mutex> installLock( installMutex );
+      acknowledged.clear();  // the matches are sent again
+    }
+    backoff = backoff.count() ? backoff * 2 : loopConfig.reconnectMin;
+    reconnectMax = loopConfig.reconnectMax;
+  }
+  if ( backoff > reconnectMax )
+    backoff = reconnectMax;
+
+  for ( ;; ) {
+    auto until = std::chrono::steady_clock::now() + backoff;
+    while ( !stopRequest && std::chrono::steady_clock::now() < until )
+      std::this_thread::sleep_for( std::chrono::milliseconds { 10 } );
+    if ( stopRequest )
+      return false;
+
+    try {
+      c.reconnect();
+      break;
+    } catch ( std::runtime_error & ) {
+      backoff = std::min( backoff * 2, reconnectMax );
+    }
+  }
+  ++reconnectCount;
+
+  {
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    BusLock busLock { c, false };
+    install( c.borrowBusObject() );
+  }
+
+  std::lock_guard<std::mutex> lock( reconnectMutex );
+  for ( auto &callback : reconnectCallbacks )
+    callback.second();
+  return true;
 }
 
 void SignalGroupImp::eventLoop() {
-  Connection c;
+  // the process wide bus unless told otherwise, Manager calls take turns with this loop
+  // through BusLock
+  Connection c = [this]() {
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    return loopConnection ? *loopConnection : Connection { ConnectionType::SHARED_SYSTEM_DBUS };
+  }();
   sd_bus *bus = (sd_bus *)c.borrowBusObject();
-  struct pollfd p;
+  struct pollfd p[2];
   int r = 0;
-  uint64_t usec;
+  std::chrono::milliseconds backoff { 0 };
 
-  p.fd = sd_bus_get_fd( bus );
-  sd_bus_get_timeout( bus, &usec );
-  p.fd = sd_bus_get_fd( bus );
+  p[0].fd = sd_bus_get_fd( bus );
+  p[1].fd = c.wakeDescriptor();  // messages other threads read while holding the bus
+  p[1].events = POLLIN;
+  wakeFd = p[1].fd;
+  loopId = std::this_thread::get_id();
+  auto lastActivity = std::chrono::steady_clock::now();
 
   while ( !stopRequest ) {
     loopRunning = true;
     if ( signalChanged ) {
-      std::lock_guard<std::mutex> lock( mutex );
-      signalChanged = false;
-
-      for ( size_t i = 0; i < signals.size(); ++i ) {
-        if ( signals[i].status() == SignalStatus::REMOVE_REQUEST ) {
-          void *slot = signals[i].slot();
-          slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
-          signals[i].updateSlot( slot );
-          signals[i].updateStatus( SignalStatus::REMOVED );
-          signals.erase( signals.begin() + i );
-        }
-
-        if ( signals[i].status() == SignalStatus::ADD_REQUEST ) {
-          std::string rule = signals[i].rule();
-          void *userdata = &signals[i];
-          void *slot = signals[i].slot();
-          r = ::sd_bus_add_match(
-            bus, (sd_bus_slot **)&slot, rule.c_str(), match_callback, userdata );
-          if ( r < 0 ) {
-            signals[i].updateStatus( SignalStatus::MATCH_FAILED );
-          } else {
-            signals[i].updateStatus( SignalStatus::ADDED );
-          }
-        }
-      }
+      std::lock_guard<std::recursive_mutex> lock( mutex );
+      BusLock busLock { c, false };
+      install( bus );
     }
 
-    r = ::sd_bus_process( bus, NULL );
-    if ( r > 0 )
+    try {
+      BusLock busLock { c, false };
+      bus = (sd_bus *)c.borrowBusObject();  // a Manager may have reconnected it
+      r = ::sd_bus_process( bus, NULL );
+      if ( r >= 0 ) {
+        p[0].fd = sd_bus_get_fd( bus );
+        p[0].events = static_cast<short int>( ::sd_bus_get_events( bus ) );
+        if ( backoff.count() && ::sd_bus_is_ready( bus ) > 0 )
+          backoff = std::chrono::milliseconds { 0 };
+      }
+    } catch ( std::runtime_error & ) {
+      r = -ENOTCONN;  // a failed reconnect elsewhere left no bus
+    }
+    deliver( c );
+    if ( r < 0 ) {  // disconnected, most likely the broker restarted
+      if ( !c.reopenable() )
+        break;  // a peer that went away, e.g. a LoopbackService
+      if ( !reconnect( c, backoff ) )
+        break;
+      continue;
+    }
+    if ( r > 0 ) {
+      lastActivity = std::chrono::steady_clock::now();
       continue;  // something's available, no need to poll events
+    }
+
+    // busy-poll: spin a while after the last message, a burst rarely comes alone
+    auto spin = std::chrono::microseconds { busyPollUsec.load( std::memory_order_relaxed ) };
+    if ( spin.count() > 0 && std::chrono::steady_clock::now() - lastActivity < spin )
+      continue;
 
-    p.events = static_cast<short int>( ::sd_bus_get_events( bus ) );
-    poll( &p, 1, 5000 );  // time in milliseconds
+    if ( poll( p, p[1].fd >= 0 ? 2 : 1, 5000 ) > 0 )  // time in milliseconds
+      lastActivity = std::chrono::steady_clock::now();
+    if ( p[1].fd >= 0 && ( p[1].revents & POLLIN ) ) {
+      eventfd_t value;
+      ::eventfd_read( p[1].fd, &value );
+    }
   }  // main while
 
   // clean up before exit the event_loop:
   // change the status from ADDED to REQUEST, so the next event_loop
   // starts a new match for each signal.
-  for ( auto &s : signals ) {
-    void *slot = s.slot();
-    if ( slot ) {
-      slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
-      s.updateSlot( slot );
+  {
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    BusLock busLock { c, false };
+    {
+      std::lock_guard<std::mutex> deliveryLock( deliveryMutex );
+      deliveries.clear();
+    }
+    wakeFd = -1;
+    loopId = std::thread::id {};
+    for ( auto &s : signals ) {
+      if ( !s )
+        continue;
+      void *slot = s->slot();
+      if ( slot ) {
+        slot = ::sd_bus_slot_unref( (sd_bus_slot *)slot );
+        s->updateSlot( slot );
+      }
+      if ( s->status() == SignalStatus::ADDED )
+        s->updateStatus( SignalStatus::ADD_REQUEST );
     }
-    if ( s.status() == SignalStatus::ADDED )
-      s.updateStatus( SignalStatus::ADD_REQUEST );
   }
 
   /* valgrin reports memory leak because it thinks
@@ -0,0 +1,62 @@
+#include "dbuscpp/type_tree.h"
+#include "internal.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace dbus;
+
+namespace {
+// the signature is already validated, returns the position after the node
+std::size_t parse( std::string_view s, std::size_t pos, TypeNode &node ) {
+  std::size_t end = pos + 1;
+  char c = s[pos];
+
+  if ( c == DATA_TYPE::ARRAY ) {
+    node.type = DATA_TYPE::ARRAY;
+    node.children.emplace_back();
+    end = parse( s, pos + 1, node.children.back() );
+    node.contents = std::string { s.substr( pos + 1, end - pos - 1 ) };
+  } else if ( c == DATA_TYPE::STRUCT_BEGIN || c == DATA_TYPE::DICT_ENTRY_BEGIN ) {
+    node.type = c == DATA_TYPE::STRUCT_BEGIN ? DATA_TYPE::STRUCT : DATA_TYPE::DICT_ENTRY;
+    while ( s[end] != DATA_TYPE::STRUCT_END && s[end] != DATA_TYPE::DICT_ENTRY_END ) {
+      node.children.emplace_back();
+      end = parse( s, end, node.children.back() );
+    }
+    node.contents = std::string { s.substr( pos + 1, end - pos - 1 ) };
+    ++end;
+  } else {
+    node.type = c;
+  }
+
+  node.signature = std::string { s.substr( pos, end - pos ) };
+  return end;
+}
+}  // namespace
+
+std::shared_ptr<const TypeTree> dbus::typeTree( std::string_view signature ) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::shared_ptr<const TypeTree>> trees;
+
+  std::string key { signature };
+  std::lock_guard<std::mutex> lock( mutex );
+
+  auto it = trees.find( key );
+  if ( it != trees.end() )
+    return it->second;
+
+  THROW_EXCEPTION_IF( !validSignature( signature ), "Invalid signature: " + key );
+
+  auto tree = std::make_shared<TypeTree>();
+  tree->signature = key;
+  for ( std::size_t pos = 0; pos < signature.size(); ) {
+    tree->types.emplace_back();
+    pos = parse( signature, pos, tree->types.back() );
+  }
+
+  // signatures come from peers as well, the cache must not grow with them
+  if ( trees.size() >= TYPE_TREES )
+    trees.clear();
+  trees.emplace( std::move( key ), tree );
+  return tree;
+}